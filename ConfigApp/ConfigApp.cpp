@@ -1,6 +1,11 @@
+#define NOMINMAX    // keep std::min/std::max usable after windows.h
 #include <windows.h>
 #include <setupapi.h>
 #include <initguid.h>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
 #include <vector>
 
@@ -24,7 +29,35 @@ std::wstring GetDevicePath(const GUID& InterfaceGuid) {
     SetupDiDestroyDeviceInfoList(hDevInfo); return L"";
 }
 
-int main() {
+// Prints the N most frequent (action, scan code) entries of the histogram
+void PrintHistogram(HANDLE hDevice, int topN) {
+    static const char* const actionNames[KB_ACTION_COUNT] = { "swapped out", "swapped in", "dropped", "transposed" };
+    KB_HISTOGRAM histogram;
+    DWORD bytes;
+    if (!DeviceIoControl(hDevice, IOCTL_KBFILTR_GET_HISTOGRAM, NULL, 0, &histogram, sizeof(histogram), &bytes, NULL)) {
+        std::cerr << "Error: " << GetLastError() << "\n";
+        return;
+    }
+
+    struct Entry { ULONG count; int action; int code; };
+    std::vector<Entry> entries;
+    for (int action = 0; action < KB_ACTION_COUNT; action++)
+        for (int code = 0; code < KB_HISTOGRAM_CODES; code++)
+            if (histogram.Counts[action][code] != 0) entries.push_back({ histogram.Counts[action][code], action, code });
+
+    size_t shown = std::min(entries.size(), (size_t)std::max(topN, 0));
+    std::partial_sort(entries.begin(), entries.begin() + shown, entries.end(),
+        [](const Entry& a, const Entry& b) { return a.count > b.count; });
+
+    if (shown == 0) { std::cout << "No injections recorded.\n"; return; }
+    for (size_t i = 0; i < shown; i++) {
+        char name[32] = "?";
+        GetKeyNameTextA(entries[i].code << 16, name, sizeof(name));
+        printf("%10lu  %-12s 0x%02X %s\n", entries[i].count, actionNames[entries[i].action], entries[i].code, name);
+    }
+}
+
+int main(int argc, char* argv[]) {
     std::cout << "--- Keyboard Filter Controller ---\n";
     std::wstring devicePath = GetDevicePath(GUID_DEVINTERFACE_KBFILTER);
     if (devicePath.empty()) { std::cerr << "Driver not found.\n"; return 1; }
@@ -32,20 +65,55 @@ int main() {
     HANDLE hDevice = CreateFile(devicePath.c_str(), GENERIC_WRITE | GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, 0, NULL);
     if (hDevice == INVALID_HANDLE_VALUE) { std::cerr << "Open failed.\n"; return 1; }
 
+    // ConfigApp histogram [N]: print the top N entries and exit
+    if (argc > 1 && strcmp(argv[1], "histogram") == 0) {
+        PrintHistogram(hDevice, argc > 2 ? atoi(argv[2]) : 20);
+        CloseHandle(hDevice);
+        return 0;
+    }
+
     while (true) {
         int prob, mode;
-        std::cout << "\nSelect Mode:\n 0: Normal\n 1: Chaos (Letters + Backspace)\n 2: Drop letters\n 3: Drop only Space\n -1: Exit\n> ";
+        std::cout << "\nSelect Mode:\n 0: Normal\n 1: Chaos (Letters + Backspace)\n 2: Drop letters\n 3: Drop only Space\n 4: Transpose adjacent keys\n -4: Set mode with burst model\n -2: Save current config for next boot\n -3: Show injection histogram\n -1: Exit\n> ";
         std::cin >> mode;
         if (mode == -1) break;
 
-        if (mode != 0) {
+        if (mode == -2) {
+            DWORD bytes;
+            if (DeviceIoControl(hDevice, IOCTL_KBFILTR_PERSIST_CONFIG, NULL, 0, NULL, 0, &bytes, NULL))
+                std::cout << "Config saved.\n";
+            else
+                std::cerr << "Error: " << GetLastError() << "\n";
+            continue;
+        }
+
+        if (mode == -3) {
+            int topN;
+            std::cout << "Top N: ";
+            std::cin >> topN;
+            PrintHistogram(hDevice, topN);
+            continue;
+        }
+
+        KB_CONFIG config = { 0 };
+        if (mode == -4) {
+            int bad, enter, exitBad;
+            std::cout << "Mode (1-4): ";
+            std::cin >> mode;
+            std::cout << "Probability (0-100): ";
+            std::cin >> prob;
+            std::cout << "Bursts: bad-state probability (0-100), enter and exit chance per 10000 keys (0 0 0 = off): ";
+            std::cin >> bad >> enter >> exitBad;
+            config.BadProbability = (ULONG)bad;
+            config.EnterBad = (ULONG)enter;
+            config.ExitBad = (ULONG)exitBad;
+        } else if (mode != 0) {
             std::cout << "Probability (0-100): ";
             std::cin >> prob;
         } else {
             prob = 0;
         }
 
-        KB_CONFIG config;
         config.Probability = (ULONG)prob;
         config.Mode = (ULONG)mode;
         DWORD bytes;
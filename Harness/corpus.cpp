@@ -0,0 +1,124 @@
+#include "corpus.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+CorpusFile::~CorpusFile() {
+    Close();
+}
+
+void CorpusFile::Close() {
+    if (base_ != nullptr) {
+        munmap(base_, size_);
+        base_ = nullptr;
+    }
+    size_ = 0;
+    packets_ = nullptr;
+    count_ = 0;
+}
+
+bool CorpusFile::Open(const std::string& path) {
+    Close();
+
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        error_ = path + ": " + std::strerror(errno);
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(KB_CORPUS_HEADER)) {
+        error_ = path + ": too small for a corpus header";
+        close(fd);
+        return false;
+    }
+
+    size_ = (size_t)st.st_size;
+    base_ = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base_ == MAP_FAILED) {
+        base_ = nullptr;
+        error_ = path + ": mmap failed: " + std::strerror(errno);
+        return false;
+    }
+    madvise(base_, size_, MADV_SEQUENTIAL);
+
+    const KB_CORPUS_HEADER& header = Header();
+    if (std::memcmp(header.Magic, KB_CORPUS_MAGIC, sizeof(header.Magic)) != 0 ||
+        header.Version != KB_CORPUS_VERSION) {
+        error_ = path + ": not a version " + std::to_string(KB_CORPUS_VERSION) + " corpus";
+    } else if (header.PacketSize != sizeof(KEYBOARD_INPUT_DATA) ||
+               header.HeaderSize < sizeof(KB_CORPUS_HEADER) ||
+               header.HeaderSize % alignof(KEYBOARD_INPUT_DATA) != 0) {
+        error_ = path + ": unsupported header or packet size";
+    } else if (header.HeaderSize > size_ ||
+               (size_ - header.HeaderSize) / sizeof(KEYBOARD_INPUT_DATA) != header.PacketCount ||
+               (size_ - header.HeaderSize) % sizeof(KEYBOARD_INPUT_DATA) != 0) {
+        error_ = path + ": packet count does not match file size";
+    } else {
+        packets_ = reinterpret_cast<const KEYBOARD_INPUT_DATA*>(
+            static_cast<const char*>(base_) + header.HeaderSize);
+        count_ = header.PacketCount;
+        return true;
+    }
+
+    Close();
+    return false;
+}
+
+void CorpusFile::Release(ULONGLONG before) {
+    if (packets_ == nullptr) {
+        return;
+    }
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t end = (size_t)((const char*)(packets_ + std::min(before, count_)) - (const char*)base_);
+    end -= end % page;
+    if (end != 0) {
+        madvise(base_, end, MADV_DONTNEED);
+    }
+}
+
+CorpusWriter::~CorpusWriter() {
+    Close();
+}
+
+bool CorpusWriter::Create(const std::string& path, ULONG seed) {
+    file_ = std::fopen(path.c_str(), "wb");
+    if (file_ == nullptr) {
+        return false;
+    }
+    std::setvbuf(file_, nullptr, _IOFBF, 1 << 20);
+
+    std::memcpy(header_.Magic, KB_CORPUS_MAGIC, sizeof(header_.Magic));
+    header_.Version = KB_CORPUS_VERSION;
+    header_.HeaderSize = sizeof(KB_CORPUS_HEADER);
+    header_.PacketSize = sizeof(KEYBOARD_INPUT_DATA);
+    header_.Seed = seed;
+    header_.PacketCount = 0;
+    return std::fwrite(&header_, sizeof(header_), 1, file_) == 1;
+}
+
+bool CorpusWriter::Write(const KEYBOARD_INPUT_DATA* packets, size_t count) {
+    if (std::fwrite(packets, sizeof(KEYBOARD_INPUT_DATA), count, file_) != count) {
+        return false;
+    }
+    header_.PacketCount += count;
+    return true;
+}
+
+bool CorpusWriter::Close() {
+    if (file_ == nullptr) {
+        return true;
+    }
+    bool ok = std::fseek(file_, 0, SEEK_SET) == 0 &&
+              std::fwrite(&header_, sizeof(header_), 1, file_) == 1;
+    ok = (std::fclose(file_) == 0) && ok;
+    file_ = nullptr;
+    return ok;
+}
@@ -0,0 +1,89 @@
+// Binary keystroke corpus: a 32-byte header followed by raw
+// KEYBOARD_INPUT_DATA packets, exactly as the class driver would hand them
+// to KbFilter_ServiceCallback. Packets start 4-byte aligned, so a mapped
+// file can be read in place as a packet array without parsing.
+//
+//   offset  size  field
+//        0     8  Magic        "KBCORPUS"
+//        8     4  Version      KB_CORPUS_VERSION
+//       12     4  HeaderSize   offset of the first packet
+//       16     4  PacketSize   sizeof(KEYBOARD_INPUT_DATA), 12
+//       20     4  Seed         generator seed, informational
+//       24     8  PacketCount
+//
+// All fields are little-endian.
+
+#ifndef KB_CORPUS_H
+#define KB_CORPUS_H
+
+#include <cstdio>
+#include <string>
+
+#include "kbport.h"
+
+#define KB_CORPUS_MAGIC     "KBCORPUS"
+#define KB_CORPUS_VERSION   1
+
+typedef struct _KB_CORPUS_HEADER {
+    char Magic[8];
+    ULONG Version;
+    ULONG HeaderSize;
+    ULONG PacketSize;
+    ULONG Seed;
+    ULONGLONG PacketCount;
+} KB_CORPUS_HEADER, * PKB_CORPUS_HEADER;
+
+static_assert(sizeof(KB_CORPUS_HEADER) == 32, "corpus header layout");
+static_assert(sizeof(KEYBOARD_INPUT_DATA) == 12, "packet layout");
+
+// Read-only memory mapping of a corpus file
+class CorpusFile {
+public:
+    CorpusFile() = default;
+    ~CorpusFile();
+    CorpusFile(const CorpusFile&) = delete;
+    CorpusFile& operator=(const CorpusFile&) = delete;
+
+    // Maps and validates the file; on failure Error() says why
+    bool Open(const std::string& path);
+
+    const KB_CORPUS_HEADER& Header() const { return *static_cast<const KB_CORPUS_HEADER*>(base_); }
+    const KEYBOARD_INPUT_DATA* Packets() const { return packets_; }
+    ULONGLONG Count() const { return count_; }
+    const std::string& Error() const { return error_; }
+
+    // Drops the mapped pages holding packets before index from memory, so
+    // a sequential pass over a large corpus stays in bounded memory. The
+    // packets can still be read; they are paged in again.
+    void Release(ULONGLONG before);
+
+private:
+    void Close();
+
+    void* base_ = nullptr;
+    size_t size_ = 0;
+    const KEYBOARD_INPUT_DATA* packets_ = nullptr;
+    ULONGLONG count_ = 0;
+    std::string error_;
+};
+
+// Streams packets to a new corpus file; the count is patched in on Close()
+class CorpusWriter {
+public:
+    CorpusWriter() = default;
+    ~CorpusWriter();
+    CorpusWriter(const CorpusWriter&) = delete;
+    CorpusWriter& operator=(const CorpusWriter&) = delete;
+
+    bool Create(const std::string& path, ULONG seed);
+    bool Write(const KEYBOARD_INPUT_DATA* packets, size_t count);
+    bool Close();
+
+    ULONGLONG Count() const { return header_.PacketCount; }
+
+private:
+    FILE* file_ = nullptr;
+    KB_CORPUS_HEADER header_ = {};
+};
+
+#endif
@@ -0,0 +1,66 @@
+// Writes a synthetic typing corpus (see corpus.h and typing_model.h).
+//
+// Usage: corpus_gen OUT_FILE [packets] [seed]
+//
+// packets is a lower bound; the corpus ends on a whole gesture with every
+// key released. Generation streams through a fixed buffer, so corpora of
+// any size can be written.
+
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include "corpus.h"
+#include "typing_model.h"
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        std::fprintf(stderr, "usage: %s OUT_FILE [packets] [seed]\n", argv[0]);
+        return 2;
+    }
+    unsigned long long packets = (argc > 2) ? std::strtoull(argv[2], nullptr, 0) : 1000000;
+    ULONG seed = (argc > 3) ? (ULONG)std::strtoul(argv[3], nullptr, 0) : 1;
+
+    CorpusWriter writer;
+    if (!writer.Create(argv[1], seed)) {
+        std::perror(argv[1]);
+        return 1;
+    }
+
+    const size_t chunk = 1 << 16;
+    std::vector<KEYBOARD_INPUT_DATA> buffer;
+    buffer.reserve(chunk + 64);
+    TypingModel model(seed);
+    unsigned long long makes = 0, extended = 0;
+    bool ok = true;
+
+    for (;;) {
+        bool last = writer.Count() + buffer.size() >= packets;
+        if (last) {
+            model.Finish(buffer);
+        }
+        if (last || buffer.size() >= chunk) {
+            for (const KEYBOARD_INPUT_DATA& p : buffer) {
+                makes += (p.Flags & KEY_BREAK) == 0;
+                extended += (p.Flags & KEY_E0) != 0;
+            }
+            ok = ok && writer.Write(buffer.data(), buffer.size());
+            buffer.clear();
+        }
+        if (last || !ok) {
+            break;
+        }
+        model.Emit(buffer);
+    }
+
+    ULONGLONG total = writer.Count();
+    if (!writer.Close() || !ok) {
+        std::perror(argv[1]);
+        return 1;
+    }
+
+    std::printf("%s: %llu packets, %llu make, %llu E0, %llu bytes, seed %u\n", argv[1],
+        (unsigned long long)total, makes, extended,
+        (unsigned long long)(sizeof(KB_CORPUS_HEADER) + total * sizeof(KEYBOARD_INPUT_DATA)), seed);
+    return 0;
+}
@@ -0,0 +1,111 @@
+// Streams a mapped corpus through the transform engine at full speed.
+//
+// Packets are read in place from the mapping; each batch is copied into one
+// reusable buffer (the engine rewrites packets in place, the mapping is
+// read-only) and transformed. Nothing is parsed or allocated per packet.
+//
+// KB_MODE_TRANSPOSE goes through KbCoreTransformStream instead, whose output
+// is compared as it is emitted; a final flush stands in for the holdback
+// timer. Either way a packet counts as changed when it differs from the
+// input packet at the same position.
+//
+// Usage: corpus_replay CORPUS [mode] [probability] [batch_packets]
+//                      [--burst BAD,ENTER,EXIT]
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "corpus.h"
+#include "kbcore.h"
+
+namespace {
+
+struct ChangeCounter {
+    const KEYBOARD_INPUT_DATA* input;
+    ULONGLONG emitted;
+    ULONGLONG changed;
+};
+
+VOID CountChanged(PVOID Context, PKEYBOARD_INPUT_DATA Start, PKEYBOARD_INPUT_DATA End) {
+    ChangeCounter* counter = static_cast<ChangeCounter*>(Context);
+    for (PKEYBOARD_INPUT_DATA p = Start; p < End; p++, counter->emitted++) {
+        const KEYBOARD_INPUT_DATA& in = counter->input[counter->emitted];
+        counter->changed += p->MakeCode != in.MakeCode || p->Flags != in.Flags;
+    }
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    // Positional arguments, in order, around the --burst option
+    KB_CONFIG config = {};
+    std::vector<const char*> args;
+    for (int i = 1; i < argc; i++) {
+        if (std::string(argv[i]) != "--burst") {
+            args.push_back(argv[i]);
+        }
+        else if (i + 1 == argc ||
+                 std::sscanf(argv[++i], "%u,%u,%u", &config.BadProbability,
+                             &config.EnterBad, &config.ExitBad) != 3) {
+            args.clear();
+            break;
+        }
+    }
+    if (args.empty() || args.size() > 4) {
+        std::fprintf(stderr, "usage: %s CORPUS [mode] [probability] [batch_packets] "
+                             "[--burst BAD,ENTER,EXIT]\n", argv[0]);
+        return 2;
+    }
+    config.Mode = (args.size() > 1) ? (ULONG)std::strtoul(args[1], nullptr, 0) : KB_MODE_CHAOS;
+    config.Probability = (args.size() > 2) ? (ULONG)std::strtoul(args[2], nullptr, 0) : 10;
+    size_t batch = (args.size() > 3) ? std::strtoul(args[3], nullptr, 0) : 64;
+
+    KB_PROFILE profile;
+    if (batch == 0 || !KbCoreCompileProfile(&profile, &config)) {
+        std::fprintf(stderr, "invalid config\n");
+        return 2;
+    }
+
+    CorpusFile corpus;
+    if (!corpus.Open(args[0])) {
+        std::fprintf(stderr, "%s\n", corpus.Error().c_str());
+        return 1;
+    }
+
+    KB_STREAM stream;
+    KbCoreInitStream(&stream, corpus.Header().Seed);
+    std::vector<KEYBOARD_INPUT_DATA> work(batch);
+    const KEYBOARD_INPUT_DATA* packets = corpus.Packets();
+    ULONGLONG count = corpus.Count();
+    ChangeCounter streamed = { packets, 0, 0 };
+    ULONGLONG changed = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    for (ULONGLONG offset = 0; offset < count; offset += batch) {
+        size_t n = (size_t)std::min<ULONGLONG>(batch, count - offset);
+        std::memcpy(work.data(), packets + offset, n * sizeof(KEYBOARD_INPUT_DATA));
+        if (KbCoreIsStreaming(&profile, &stream)) {
+            KbCoreTransformStream(&profile, &stream, work.data(), work.data() + n, CountChanged, &streamed);
+            continue;
+        }
+        KbCoreTransform(&profile, &stream, work.data(), work.data() + n);
+        for (size_t i = 0; i < n; i++) {
+            changed += work[i].MakeCode != packets[offset + i].MakeCode ||
+                       work[i].Flags != packets[offset + i].Flags;
+        }
+    }
+    KbCoreFlushStream(&stream, CountChanged, &streamed);
+    changed += streamed.changed;
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    double bytes = (double)count * sizeof(KEYBOARD_INPUT_DATA);
+    std::printf("%llu packets, %llu changed, %.3f s, %.1f Mpackets/s, %.2f GB/s\n",
+        (unsigned long long)count, (unsigned long long)changed, seconds,
+        count / seconds / 1e6, bytes / seconds / 1e9);
+    return 0;
+}
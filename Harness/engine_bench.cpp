@@ -0,0 +1,249 @@
+// Benchmark suite for the keystroke transform engine.
+//
+// Sweeps mode (0-4), probability (0, 1, 10, 100%, plus a bursty
+// Gilbert-Elliott config, "burst": true), batch size (1-4096 packets), the
+// share of make packets in the stream, and single-device vs. multi-device
+// threading. Each device is one thread with its own KB_STREAM,
+// all sharing one compiled KB_PROFILE, as in the driver. Transposition runs
+// through KbCoreTransformStream into an emit routine that only counts, the
+// driver's path for that mode; the other modes use the in-place kernels.
+//
+// Every batch is restored from a pristine copy before it is transformed
+// (the engine rewrites packets in place); restore_ns_per_packet is that copy
+// alone, so ns_per_packet - restore_ns_per_packet is the engine's cost.
+// ns_per_packet is per device; mpackets_per_sec is the aggregate over all
+// devices.
+//
+// Usage: engine_bench [--format json|csv] [--out FILE] [--min-time-ms N]
+//                     [--threads N]
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "kbcore.h"
+
+namespace {
+
+struct Options {
+    bool json = true;
+    std::string out;
+    double minTimeMs = 20.0;
+    unsigned threads = 0;
+};
+
+struct Result {
+    ULONG mode;
+    ULONG probability;
+    bool burst;
+    size_t batch;
+    unsigned makePercent;
+    unsigned threads;
+    double nsPerPacket;
+    double restoreNsPerPacket;
+    double mpacketsPerSec;
+};
+
+const ULONG kProbabilities[] = { 0, 1, 10, 100 };
+
+// 1% when good, 50% when bad; bursts start every ~1000 makes and last ~10
+const KB_CONFIG kBurst = { 1, 0, 50, 10, 1000 };
+const size_t kBatchSizes[] = { 1, 4, 16, 64, 256, 1024, 4096 };
+const unsigned kMakePercents[] = { 0, 50, 100 };
+
+// makePercent% of the packets are make codes, spread evenly through the batch
+std::vector<KEYBOARD_INPUT_DATA> MakeBatch(size_t packets, unsigned makePercent) {
+    std::vector<KEYBOARD_INPUT_DATA> batch(packets);
+    for (size_t i = 0; i < packets; i++) {
+        KEYBOARD_INPUT_DATA& p = batch[i];
+        bool make = ((i + 1) * makePercent / 100) != (i * makePercent / 100);
+        std::memset(&p, 0, sizeof(p));
+        p.MakeCode = (i % 8 == 7) ? 0x39 : (USHORT)(0x10 + i % 26);
+        p.Flags = make ? KEY_MAKE : KEY_BREAK;
+    }
+    return batch;
+}
+
+struct Sample {
+    double packets;
+    double elapsedNs;
+};
+
+// Runs whole batches until minTimeMs has elapsed
+template <typename Fn>
+Sample Measure(const std::vector<KEYBOARD_INPUT_DATA>& input, double minTimeMs, Fn fn) {
+    std::vector<KEYBOARD_INPUT_DATA> work(input.size());
+    size_t rounds = 0;
+    size_t step = std::max<size_t>(1, 4096 / input.size());
+    auto start = std::chrono::steady_clock::now();
+    double elapsedNs;
+
+    do {
+        for (size_t i = 0; i < step; i++) {
+            std::memcpy(work.data(), input.data(), input.size() * sizeof(KEYBOARD_INPUT_DATA));
+            fn(work.data(), work.data() + work.size());
+        }
+        rounds += step;
+        elapsedNs = std::chrono::duration<double, std::nano>(
+            std::chrono::steady_clock::now() - start).count();
+    } while (elapsedNs < minTimeMs * 1e6);
+
+    return { (double)(rounds * input.size()), elapsedNs };
+}
+
+VOID CountEmitted(PVOID Context, PKEYBOARD_INPUT_DATA Start, PKEYBOARD_INPUT_DATA End) {
+    *static_cast<size_t*>(Context) += (size_t)(End - Start);
+}
+
+// One thread per device, released together. Returns the mean per-device
+// ns/packet and the aggregate Mpackets/s over the wall-clock window.
+void MeasureDevices(const KB_PROFILE& profile, const std::vector<KEYBOARD_INPUT_DATA>& input,
+                    unsigned devices, double minTimeMs, Result& result) {
+    std::vector<Sample> perDevice(devices);
+    std::vector<std::thread> workers;
+    std::atomic<unsigned> ready(0);
+
+    for (unsigned d = 0; d < devices; d++) {
+        workers.emplace_back([&, d] {
+            KB_STREAM stream;
+            KbCoreInitStream(&stream, 0x1234567 + d);
+            size_t emitted = 0;
+            auto transform = [&](PKEYBOARD_INPUT_DATA s, PKEYBOARD_INPUT_DATA e) {
+                if (KbCoreIsStreaming(&profile, &stream)) {
+                    KbCoreTransformStream(&profile, &stream, s, e, CountEmitted, &emitted);
+                } else {
+                    KbCoreTransform(&profile, &stream, s, e);
+                }
+            };
+            Measure(input, minTimeMs / 10, transform);  // warm-up
+            ready++;
+            while (ready.load() < devices) {
+                std::this_thread::yield();
+            }
+            perDevice[d] = Measure(input, minTimeMs, transform);
+        });
+    }
+    for (auto& t : workers) {
+        t.join();
+    }
+
+    double packets = 0, nsPerPacket = 0, wallNs = 0;
+    for (const Sample& s : perDevice) {
+        packets += s.packets;
+        nsPerPacket += s.elapsedNs / s.packets;
+        wallNs = std::max(wallNs, s.elapsedNs);
+    }
+    result.nsPerPacket = nsPerPacket / devices;
+    result.mpacketsPerSec = packets * 1e3 / wallNs;
+}
+
+bool ParseArgs(int argc, char** argv, Options& options) {
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (i + 1 >= argc) {
+            return false;
+        }
+        std::string value = argv[++i];
+        if (arg == "--format" && (value == "json" || value == "csv")) {
+            options.json = (value == "json");
+        } else if (arg == "--out") {
+            options.out = value;
+        } else if (arg == "--min-time-ms") {
+            options.minTimeMs = std::atof(value.c_str());
+        } else if (arg == "--threads") {
+            options.threads = (unsigned)std::strtoul(value.c_str(), nullptr, 0);
+        } else {
+            return false;
+        }
+    }
+    return options.minTimeMs > 0;
+}
+
+void Write(FILE* out, const Options& options, const std::vector<Result>& results) {
+    if (options.json) {
+        std::fprintf(out, "{\n  \"benchmark\": \"engine_bench\",\n  \"results\": [\n");
+        for (size_t i = 0; i < results.size(); i++) {
+            const Result& r = results[i];
+            std::fprintf(out,
+                "    {\"mode\": %u, \"probability\": %u, \"burst\": %s, \"batch\": %zu, "
+                "\"make_percent\": %u, \"threads\": %u, \"ns_per_packet\": %.4f, "
+                "\"restore_ns_per_packet\": %.4f, \"mpackets_per_sec\": %.2f}%s\n",
+                r.mode, r.probability, r.burst ? "true" : "false", r.batch, r.makePercent, r.threads, r.nsPerPacket,
+                r.restoreNsPerPacket, r.mpacketsPerSec, (i + 1 < results.size()) ? "," : "");
+        }
+        std::fprintf(out, "  ]\n}\n");
+    } else {
+        std::fprintf(out, "mode,probability,burst,batch,make_percent,threads,ns_per_packet,"
+                          "restore_ns_per_packet,mpackets_per_sec\n");
+        for (const Result& r : results) {
+            std::fprintf(out, "%u,%u,%d,%zu,%u,%u,%.4f,%.4f,%.2f\n", r.mode, r.probability,
+                r.burst ? 1 : 0, r.batch, r.makePercent, r.threads, r.nsPerPacket, r.restoreNsPerPacket, r.mpacketsPerSec);
+        }
+    }
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    Options options;
+    if (!ParseArgs(argc, argv, options)) {
+        std::fprintf(stderr, "usage: %s [--format json|csv] [--out FILE] [--min-time-ms N] "
+                             "[--threads N]\n", argv[0]);
+        return 2;
+    }
+
+    unsigned multi = options.threads ? options.threads
+                                     : std::max(2u, std::thread::hardware_concurrency());
+    std::vector<Result> results;
+
+    for (size_t batch : kBatchSizes) {
+        for (unsigned makePercent : kMakePercents) {
+            std::vector<KEYBOARD_INPUT_DATA> input = MakeBatch(batch, makePercent);
+            auto restoreOnly = [](PKEYBOARD_INPUT_DATA, PKEYBOARD_INPUT_DATA) {};
+            Measure(input, options.minTimeMs / 10, restoreOnly);  // warm-up
+            Sample restore = Measure(input, options.minTimeMs, restoreOnly);
+            double restoreNs = restore.elapsedNs / restore.packets;
+
+            for (ULONG mode = 0; mode < KB_MODE_COUNT; mode++) {
+                std::vector<KB_CONFIG> configs;
+                for (ULONG probability : kProbabilities) {
+                    configs.push_back({ probability, mode });
+                }
+                configs.push_back(kBurst);
+                configs.back().Mode = mode;
+
+                for (const KB_CONFIG& config : configs) {
+                    KB_PROFILE profile;
+                    KbCoreCompileProfile(&profile, &config);
+
+                    for (unsigned threads : { 1u, multi }) {
+                        Result result = { mode, config.Probability, config.EnterBad != 0, batch,
+                                          makePercent, threads, 0, restoreNs, 0 };
+                        MeasureDevices(profile, input, threads, options.minTimeMs, result);
+                        results.push_back(result);
+                    }
+                }
+            }
+        }
+    }
+
+    FILE* out = stdout;
+    if (!options.out.empty()) {
+        out = std::fopen(options.out.c_str(), "w");
+        if (out == nullptr) {
+            std::perror(options.out.c_str());
+            return 1;
+        }
+    }
+    Write(out, options, results);
+    if (out != stdout) {
+        std::fclose(out);
+    }
+    return 0;
+}
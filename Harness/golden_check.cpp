@@ -0,0 +1,501 @@
+// Golden-output regression check for the transform engine.
+//
+// Streams keystroke corpora through the portable engine with fixed seeds
+// and compares every packet it emits against a golden corpus (corpus.h
+// format; the header's Seed is the engine seed). The first diverging
+// packet is reported with the input, golden and actual packets around it,
+// and the run stops there.
+//
+// The built-in cases (kCases) read their input from the recorded corpus
+// golden/input/<name>.corpus and compare against golden/<name>.corpus, so
+// a change to TypingModel cannot pass for an engine divergence. The inputs
+// are what corpus_gen writes for the case's seed and size: --record-inputs
+// rewrites them, and --check-inputs reports where TypingModel no longer
+// produces them, as an error of its own. A recorded corpus of any size is
+// checked with
+// --corpus and --golden: both files are mapped and walked in chunks, and
+// the pages behind the current chunk are released, so memory stays bounded
+// by the chunk size. Emitted packets are compared against the mapping as
+// the engine hands them out; nothing is buffered.
+//
+// Every mode runs through KbCoreTransformStream, which for the in-place
+// modes emits each batch after the kernel has rewritten it. A final flush
+// stands in for the holdback timer.
+//
+// Usage: golden_check [--golden-dir DIR] [--case NAME] [--batch N]
+//                     [--regenerate] [--perturb N]
+//        golden_check [--golden-dir DIR] [--case NAME]
+//                     --record-inputs | --check-inputs
+//        golden_check --corpus IN --golden OUT [--mode M] [--probability P]
+//                     [--burst BAD,ENTER,EXIT] [--seed S] [--batch N]
+//                     [--regenerate] [--perturb N]
+//
+// --regenerate writes the golden files, from the recorded inputs, instead
+// of comparing against them.
+// --perturb N alters packet N of the engine's output before the compare,
+// to see a divergence being caught and reported.
+//
+// Exits 1 on a divergence or I/O error.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "corpus.h"
+#include "kbcore.h"
+#include "typing_model.h"
+
+namespace {
+
+const size_t kChunk = 1 << 16;
+const ULONGLONG kContext = 3;
+const ULONGLONG kNoPerturb = ~0ull;
+
+struct Case {
+    const char* name;
+    KB_CONFIG config;
+    ULONG seed;             // engine seed
+    ULONG corpusSeed;       // TypingModel seed of the recorded input
+    ULONGLONG packets;      // lower bound, as for corpus_gen
+};
+
+const Case kCases[] = {
+    { "chaos_10", { 10, KB_MODE_CHAOS }, 1, 101, 8192 },
+    { "drop_25", { 25, KB_MODE_DROP }, 2, 102, 8192 },
+    // A dropped space make keeps its flags and gets KEY_BREAK as MakeCode
+    { "drop_space_100", { 100, KB_MODE_DROP_SPACE }, 3, 103, 8192 },
+    { "drop_space_30", { 30, KB_MODE_DROP_SPACE }, 4, 104, 8192 },
+    { "transpose_50", { 50, KB_MODE_TRANSPOSE }, 5, 105, 8192 },
+    { "burst_chaos", { 2, KB_MODE_CHAOS, 60, 50, 500 }, 6, 106, 8192 },
+    { "burst_transpose", { 5, KB_MODE_TRANSPOSE, 70, 100, 1000 }, 7, 107, 8192 },
+};
+
+// Input in chunks of about kChunk packets
+class Source {
+public:
+    virtual ~Source() = default;
+
+    // Next chunk; FALSE at the end of the input
+    virtual bool Next(const KEYBOARD_INPUT_DATA** packets, size_t* count) = 0;
+
+    // Input packet index, if still at hand, for reporting
+    virtual const KEYBOARD_INPUT_DATA* At(ULONGLONG index) const = 0;
+};
+
+// TypingModel output, generated one chunk at a time exactly as corpus_gen does
+class ModelSource : public Source {
+public:
+    ModelSource(ULONG seed, ULONGLONG packets) : model_(seed), packets_(packets) {
+        buffer_.reserve(kChunk + 64);
+    }
+
+    bool Next(const KEYBOARD_INPUT_DATA** packets, size_t* count) override {
+        if (done_) {
+            return false;
+        }
+        base_ += buffer_.size();
+        buffer_.clear();
+        for (;;) {
+            if (base_ + buffer_.size() >= packets_) {
+                model_.Finish(buffer_);
+                done_ = true;
+                break;
+            }
+            if (buffer_.size() >= kChunk) {
+                break;
+            }
+            model_.Emit(buffer_);
+        }
+        *packets = buffer_.data();
+        *count = buffer_.size();
+        return true;
+    }
+
+    const KEYBOARD_INPUT_DATA* At(ULONGLONG index) const override {
+        return (index >= base_ && index - base_ < buffer_.size()) ? &buffer_[index - base_] : nullptr;
+    }
+
+private:
+    TypingModel model_;
+    ULONGLONG packets_;
+    ULONGLONG base_ = 0;
+    bool done_ = false;
+    std::vector<KEYBOARD_INPUT_DATA> buffer_;
+};
+
+// A mapped corpus; chunks already handed out are released
+class FileSource : public Source {
+public:
+    explicit FileSource(CorpusFile& file) : file_(file) {}
+
+    bool Next(const KEYBOARD_INPUT_DATA** packets, size_t* count) override {
+        if (next_ >= file_.Count()) {
+            return false;
+        }
+        file_.Release(next_);
+        *packets = file_.Packets() + next_;
+        *count = (size_t)std::min<ULONGLONG>(kChunk, file_.Count() - next_);
+        next_ += *count;
+        return true;
+    }
+
+    const KEYBOARD_INPUT_DATA* At(ULONGLONG index) const override {
+        return (index < file_.Count()) ? &file_.Packets()[index] : nullptr;
+    }
+
+private:
+    CorpusFile& file_;
+    ULONGLONG next_ = 0;
+};
+
+// Emit context: checks emitted packets against the golden output, or
+// writes them out when regenerating
+struct Sink {
+    const KEYBOARD_INPUT_DATA* golden = nullptr;
+    ULONGLONG goldenCount = 0;
+    CorpusWriter* writer = nullptr;
+    ULONGLONG perturb = kNoPerturb;
+
+    ULONGLONG emitted = 0;
+    bool failed = false;
+    bool diverged = false;
+    ULONGLONG at = 0;
+    std::vector<KEYBOARD_INPUT_DATA> actual;    // from the divergence on
+};
+
+bool SamePacket(const KEYBOARD_INPUT_DATA& a, const KEYBOARD_INPUT_DATA& b) {
+    return std::memcmp(&a, &b, sizeof(KEYBOARD_INPUT_DATA)) == 0;
+}
+
+VOID Compare(PVOID Context, PKEYBOARD_INPUT_DATA Start, PKEYBOARD_INPUT_DATA End) {
+    Sink& sink = *static_cast<Sink*>(Context);
+    size_t n = (size_t)(End - Start);
+
+    if (sink.diverged || sink.failed) {
+        return;
+    }
+    if (sink.perturb - sink.emitted < n) {
+        Start[sink.perturb - sink.emitted].MakeCode ^= 0x40;
+    }
+
+    if (sink.writer != nullptr) {
+        sink.failed = !sink.writer->Write(Start, n);
+    } else if (sink.emitted + n > sink.goldenCount ||
+               std::memcmp(sink.golden + sink.emitted, Start, n * sizeof(KEYBOARD_INPUT_DATA)) != 0) {
+        size_t i = 0;
+        while (i < n && sink.emitted + i < sink.goldenCount &&
+               SamePacket(sink.golden[sink.emitted + i], Start[i])) {
+            i++;
+        }
+        sink.diverged = true;
+        sink.at = sink.emitted + i;
+        sink.actual.assign(Start + i, Start + std::min<size_t>(n, i + kContext + 1));
+    }
+    sink.emitted += n;
+}
+
+// Streams source through the engine into sink; golden, if any, is the
+// mapping sink compares against and is released behind the compare
+void Run(const KB_PROFILE& profile, ULONG seed, size_t batch, Source& source, Sink& sink,
+         CorpusFile* golden) {
+    KB_STREAM stream;
+    KbCoreInitStream(&stream, seed);
+    std::vector<KEYBOARD_INPUT_DATA> work;
+    const KEYBOARD_INPUT_DATA* packets;
+    size_t count;
+
+    while (!sink.diverged && !sink.failed && source.Next(&packets, &count)) {
+        work.assign(packets, packets + count);
+        for (size_t i = 0; i < count && !sink.diverged; i += batch) {
+            size_t end = std::min(count, i + batch);
+            KbCoreTransformStream(&profile, &stream, work.data() + i, work.data() + end, Compare, &sink);
+        }
+        if (golden != nullptr) {
+            golden->Release(sink.emitted);
+        }
+    }
+    KbCoreFlushStream(&stream, Compare, &sink);
+
+    if (sink.writer == nullptr && !sink.diverged && sink.emitted != sink.goldenCount) {
+        sink.diverged = true;
+        sink.at = sink.emitted;
+        sink.actual.clear();
+    }
+}
+
+std::string Describe(const KEYBOARD_INPUT_DATA* p) {
+    if (p == nullptr) {
+        return "-";
+    }
+    char buffer[64];
+    std::snprintf(buffer, sizeof(buffer), "0x%02X %s%s%s", p->MakeCode,
+        (p->Flags & KEY_BREAK) ? "break" : "make", (p->Flags & KEY_E0) ? " e0" : "",
+        (p->Flags & KEY_E1) ? " e1" : "");
+    return buffer;
+}
+
+void Report(const char* name, const Sink& sink, const Source& source) {
+    std::printf("%s: first divergence at packet %llu (golden has %llu packets)\n", name,
+        (unsigned long long)sink.at, (unsigned long long)sink.goldenCount);
+    std::printf("  %14s  %-16s %-16s %s\n", "packet", "input", "golden", "actual");
+
+    ULONGLONG first = (sink.at > kContext) ? sink.at - kContext : 0;
+    for (ULONGLONG j = first; j <= sink.at + kContext; j++) {
+        const KEYBOARD_INPUT_DATA* golden = (j < sink.goldenCount) ? &sink.golden[j] : nullptr;
+        const KEYBOARD_INPUT_DATA* actual = (j < sink.at) ? golden
+            : (j - sink.at < sink.actual.size()) ? &sink.actual[j - sink.at] : nullptr;
+        if (golden == nullptr && actual == nullptr && source.At(j) == nullptr) {
+            break;
+        }
+        std::printf("%s %14llu  %-16s %-16s %s\n", (j == sink.at) ? ">" : " ",
+            (unsigned long long)j, Describe(source.At(j)).c_str(), Describe(golden).c_str(),
+            Describe(actual).c_str());
+    }
+}
+
+// Opens a case's recorded input; returns FALSE, with a message, if it is
+// missing or was not generated with the case's TypingModel seed
+bool OpenInput(const Case& c, const std::string& path, CorpusFile& input) {
+    if (!input.Open(path)) {
+        std::fprintf(stderr, "%s: %s\n", c.name, input.Error().c_str());
+        return false;
+    }
+    if (input.Header().Seed != c.corpusSeed) {
+        std::fprintf(stderr, "%s: input was recorded with TypingModel seed %u, not %u\n", c.name,
+            input.Header().Seed, c.corpusSeed);
+        return false;
+    }
+    return true;
+}
+
+// Writes a case's input as TypingModel generates it
+bool RecordInput(const Case& c, const std::string& path) {
+    ModelSource source(c.corpusSeed, c.packets);
+    CorpusWriter writer;
+    const KEYBOARD_INPUT_DATA* packets;
+    size_t count;
+
+    if (!writer.Create(path, c.corpusSeed)) {
+        std::perror(path.c_str());
+        return false;
+    }
+    while (source.Next(&packets, &count)) {
+        if (!writer.Write(packets, count)) {
+            std::perror(path.c_str());
+            return false;
+        }
+    }
+    if (!writer.Close()) {
+        std::perror(path.c_str());
+        return false;
+    }
+    std::printf("%s: wrote %s, %llu packets\n", c.name, path.c_str(), (unsigned long long)writer.Count());
+    return true;
+}
+
+// Checks that TypingModel still generates a case's recorded input
+bool CheckInput(const Case& c, const std::string& path) {
+    CorpusFile input;
+    if (!OpenInput(c, path, input)) {
+        return false;
+    }
+    ModelSource source(c.corpusSeed, c.packets);
+    const KEYBOARD_INPUT_DATA* packets;
+    size_t count;
+    ULONGLONG at = 0;
+
+    while (source.Next(&packets, &count)) {
+        for (size_t i = 0; i < count; i++, at++) {
+            if (at >= input.Count() || !SamePacket(packets[i], input.Packets()[at])) {
+                std::printf("%s: TypingModel output differs from the recorded input at packet %llu\n",
+                    c.name, (unsigned long long)at);
+                return false;
+            }
+        }
+    }
+    if (at != input.Count()) {
+        std::printf("%s: TypingModel output ends at packet %llu, the recorded input at %llu\n", c.name,
+            (unsigned long long)at, (unsigned long long)input.Count());
+        return false;
+    }
+    std::printf("%s: TypingModel reproduces the recorded input, %llu packets\n", c.name,
+        (unsigned long long)at);
+    return true;
+}
+
+// Regenerates or checks one golden file; returns FALSE on failure
+bool CheckOne(const char* name, const KB_CONFIG& config, ULONG seed, size_t batch, Source& source,
+              const std::string& goldenPath, bool regenerate, ULONGLONG perturb) {
+    KB_PROFILE profile;
+    if (!KbCoreCompileProfile(&profile, &config)) {
+        std::fprintf(stderr, "%s: invalid config\n", name);
+        return false;
+    }
+
+    Sink sink;
+    sink.perturb = perturb;
+    auto start = std::chrono::steady_clock::now();
+
+    if (regenerate) {
+        CorpusWriter writer;
+        if (!writer.Create(goldenPath, seed)) {
+            std::perror(goldenPath.c_str());
+            return false;
+        }
+        sink.writer = &writer;
+        Run(profile, seed, batch, source, sink, nullptr);
+        if (!writer.Close() || sink.failed) {
+            std::perror(goldenPath.c_str());
+            return false;
+        }
+        std::printf("%s: wrote %s, %llu packets\n", name, goldenPath.c_str(),
+            (unsigned long long)sink.emitted);
+        return true;
+    }
+
+    CorpusFile golden;
+    if (!golden.Open(goldenPath)) {
+        std::fprintf(stderr, "%s: %s\n", name, golden.Error().c_str());
+        return false;
+    }
+    if (golden.Header().Seed != seed) {
+        std::fprintf(stderr, "%s: golden output was made with seed %u, not %u\n", name,
+            golden.Header().Seed, seed);
+        return false;
+    }
+    sink.golden = golden.Packets();
+    sink.goldenCount = golden.Count();
+    Run(profile, seed, batch, source, sink, &golden);
+
+    if (sink.diverged) {
+        Report(name, sink, source);
+        return false;
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::printf("%s: %llu packets match, %.3f s, %.2f GB/s\n", name,
+        (unsigned long long)sink.emitted, seconds,
+        sink.emitted * sizeof(KEYBOARD_INPUT_DATA) / seconds / 1e9);
+    return true;
+}
+
+struct Options {
+    std::string goldenDir = "golden";
+    std::string caseName;
+    std::string corpus;
+    std::string golden;
+    KB_CONFIG config = { 10, KB_MODE_CHAOS };
+    bool seedSet = false;
+    ULONG seed = 0;
+    size_t batch = 4096;
+    bool regenerate = false;
+    bool recordInputs = false;
+    bool checkInputs = false;
+    ULONGLONG perturb = kNoPerturb;
+};
+
+bool ParseArgs(int argc, char** argv, Options& options) {
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--regenerate") {
+            options.regenerate = true;
+            continue;
+        }
+        if (arg == "--record-inputs") {
+            options.recordInputs = true;
+            continue;
+        }
+        if (arg == "--check-inputs") {
+            options.checkInputs = true;
+            continue;
+        }
+        if (i + 1 >= argc) {
+            return false;
+        }
+        const char* value = argv[++i];
+        if (arg == "--golden-dir") options.goldenDir = value;
+        else if (arg == "--case") options.caseName = value;
+        else if (arg == "--corpus") options.corpus = value;
+        else if (arg == "--golden") options.golden = value;
+        else if (arg == "--mode") options.config.Mode = (ULONG)std::strtoul(value, nullptr, 0);
+        else if (arg == "--probability") options.config.Probability = (ULONG)std::strtoul(value, nullptr, 0);
+        else if (arg == "--burst") {
+            if (std::sscanf(value, "%u,%u,%u", &options.config.BadProbability,
+                            &options.config.EnterBad, &options.config.ExitBad) != 3) {
+                return false;
+            }
+        }
+        else if (arg == "--seed") {
+            options.seed = (ULONG)std::strtoul(value, nullptr, 0);
+            options.seedSet = true;
+        }
+        else if (arg == "--batch") options.batch = std::strtoul(value, nullptr, 0);
+        else if (arg == "--perturb") options.perturb = std::strtoull(value, nullptr, 0);
+        else return false;
+    }
+    const bool inputs = options.recordInputs || options.checkInputs;
+    return options.batch > 0 && options.corpus.empty() == options.golden.empty() &&
+           !(options.recordInputs && options.checkInputs) &&
+           !(inputs && (options.regenerate || !options.corpus.empty()));
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    Options options;
+    if (!ParseArgs(argc, argv, options)) {
+        std::fprintf(stderr,
+            "usage: %s [--golden-dir DIR] [--case NAME] [--batch N] [--regenerate] [--perturb N]\n"
+            "       %s [--golden-dir DIR] [--case NAME] --record-inputs | --check-inputs\n"
+            "       %s --corpus IN --golden OUT [--mode M] [--probability P]\n"
+            "          [--burst BAD,ENTER,EXIT] [--seed S] [--batch N] [--regenerate] [--perturb N]\n",
+            argv[0], argv[0], argv[0]);
+        return 2;
+    }
+
+    if (!options.corpus.empty()) {
+        CorpusFile corpus;
+        if (!corpus.Open(options.corpus)) {
+            std::fprintf(stderr, "%s\n", corpus.Error().c_str());
+            return 1;
+        }
+        ULONG seed = options.seedSet ? options.seed : corpus.Header().Seed;
+        FileSource source(corpus);
+        return CheckOne(options.corpus.c_str(), options.config, seed, options.batch, source,
+                        options.golden, options.regenerate, options.perturb) ? 0 : 1;
+    }
+
+    int failures = 0, ran = 0;
+    for (const Case& c : kCases) {
+        if (!options.caseName.empty() && options.caseName != c.name) {
+            continue;
+        }
+        ran++;
+        std::string inputPath = options.goldenDir + "/input/" + c.name + ".corpus";
+        if (options.recordInputs) {
+            failures += !RecordInput(c, inputPath);
+            continue;
+        }
+        if (options.checkInputs) {
+            failures += !CheckInput(c, inputPath);
+            continue;
+        }
+        CorpusFile input;
+        if (!OpenInput(c, inputPath, input)) {
+            failures++;
+            continue;
+        }
+        FileSource source(input);
+        std::string path = options.goldenDir + "/" + c.name + ".corpus";
+        failures += !CheckOne(c.name, c.config, c.seed, options.batch, source, path,
+                              options.regenerate, options.perturb);
+    }
+    if (ran == 0) {
+        std::fprintf(stderr, "no case named %s\n", options.caseName.c_str());
+        return 2;
+    }
+    return failures ? 1 : 0;
+}
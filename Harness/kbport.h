@@ -0,0 +1,92 @@
+/*++
+
+Module Name:
+
+    kbport.h
+
+Abstract:
+
+    Minimal stand-ins for the Windows base types and keyboard definitions
+    used by the portable transform engine (kbcore.c), so that it can be
+    compiled and exercised in user mode on Linux.
+
+    Widths follow the Windows LLP64 model: ULONG is 32 bits everywhere.
+
+Environment:
+
+    User mode only (non-Windows).
+
+--*/
+#ifndef KBPORT_H
+#define KBPORT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#define IN
+#define OUT
+#define OPTIONAL
+
+#ifndef VOID
+#define VOID void
+#endif
+
+typedef uint8_t     UCHAR, *PUCHAR;
+typedef uint16_t    USHORT, *PUSHORT;
+typedef uint32_t    ULONG, *PULONG;
+typedef int32_t     LONG, *PLONG;
+typedef uint64_t    ULONGLONG, *PULONGLONG;
+typedef int64_t     LONGLONG, *PLONGLONG;
+typedef uintptr_t   ULONG_PTR, *PULONG_PTR;
+typedef void        *PVOID;
+typedef UCHAR       BOOLEAN, *PBOOLEAN;
+typedef LONG        NTSTATUS;
+
+#define TRUE    1
+#define FALSE   0
+
+#ifndef FORCEINLINE
+#define FORCEINLINE static inline __attribute__((always_inline))
+#endif
+
+#define UNREFERENCED_PARAMETER(P) ((void)(P))
+#define RTL_NUMBER_OF(A) (sizeof(A) / sizeof((A)[0]))
+#define FIELD_OFFSET(type, field) ((LONG)offsetof(type, field))
+
+#define RtlCopyMemory(Destination, Source, Length) memcpy((Destination), (Source), (Length))
+#define RtlMoveMemory(Destination, Source, Length) memmove((Destination), (Source), (Length))
+#define RtlZeroMemory(Destination, Length) memset((Destination), 0, (Length))
+
+//
+// winioctl.h
+//
+#define CTL_CODE(DeviceType, Function, Method, Access) \
+    (((DeviceType) << 16) | ((Access) << 14) | ((Function) << 2) | (Method))
+
+#define FILE_DEVICE_KEYBOARD    0x0000000b
+#define METHOD_BUFFERED         0
+#define FILE_ANY_ACCESS         0
+#define FILE_READ_DATA          0x0001
+#define FILE_WRITE_DATA         0x0002
+
+//
+// ntddkbd.h
+//
+typedef struct _KEYBOARD_INPUT_DATA {
+    USHORT UnitId;
+    USHORT MakeCode;
+    USHORT Flags;
+    USHORT Reserved;
+    ULONG ExtraInformation;
+} KEYBOARD_INPUT_DATA, *PKEYBOARD_INPUT_DATA;
+
+#define KEY_MAKE                0
+#define KEY_BREAK               1
+#define KEY_E0                  2
+#define KEY_E1                  4
+#define KEY_TERMSRV_SET_LED     8
+#define KEY_TERMSRV_SHADOW      0x10
+#define KEY_TERMSRV_VKPACKET    0x20
+
+#endif
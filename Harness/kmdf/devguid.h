@@ -0,0 +1,15 @@
+/*++
+
+Module Name:
+
+    devguid.h (kmdf shim)
+
+--*/
+#ifndef KMDF_SHIM_DEVGUID_H
+#define KMDF_SHIM_DEVGUID_H
+
+#include "initguid.h"
+
+DEFINE_GUID(GUID_DEVCLASS_KEYBOARD, 0x4d36e96b, 0xe325, 0x11ce, 0xbf, 0xc1, 0x08, 0x00, 0x2b, 0xe1, 0x03, 0x18);
+
+#endif
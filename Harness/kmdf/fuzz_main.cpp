@@ -0,0 +1,42 @@
+// Stand-alone driver for libFuzzer targets when the compiler has no
+// -fsanitize=fuzzer: replays each file given on the command line, or with
+// no arguments runs a fixed number of pseudo-random inputs as a smoke test.
+
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <vector>
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size);
+
+int main(int argc, char** argv) {
+    if (argc > 1) {
+        for (int i = 1; i < argc; i++) {
+            std::ifstream file(argv[i], std::ios::binary);
+            if (!file) {
+                std::perror(argv[i]);
+                return 1;
+            }
+            std::vector<uint8_t> input((std::istreambuf_iterator<char>(file)),
+                                       std::istreambuf_iterator<char>());
+            LLVMFuzzerTestOneInput(input.data(), input.size());
+        }
+        return 0;
+    }
+
+    uint64_t state = 0x2545F4914F6CDD1Dull;
+    std::vector<uint8_t> input;
+    for (int run = 0; run < 100000; run++) {
+        input.resize(run % 257);
+        for (uint8_t& b : input) {
+            state ^= state << 13;
+            state ^= state >> 7;
+            state ^= state << 17;
+            b = (uint8_t)state;
+        }
+        LLVMFuzzerTestOneInput(input.data(), input.size());
+    }
+    std::printf("100000 inputs ok\n");
+    return 0;
+}
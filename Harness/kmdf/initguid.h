@@ -0,0 +1,22 @@
+/*++
+
+Module Name:
+
+    initguid.h (kmdf shim)
+
+Abstract:
+
+    DEFINE_GUID always defines the GUID, with internal linkage so that
+    every translation unit may include the same definitions.
+
+--*/
+#ifndef KMDF_SHIM_INITGUID_H
+#define KMDF_SHIM_INITGUID_H
+
+#include "ntddk.h"
+
+#undef DEFINE_GUID
+#define DEFINE_GUID(name, l, w1, w2, b1, b2, b3, b4, b5, b6, b7, b8) \
+    static const GUID name __attribute__((unused)) = { l, w1, w2, { b1, b2, b3, b4, b5, b6, b7, b8 } }
+
+#endif
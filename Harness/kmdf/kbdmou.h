@@ -0,0 +1,32 @@
+/*++
+
+Module Name:
+
+    kbdmou.h (kmdf shim)
+
+Abstract:
+
+    Class/port driver connect interface, as used by kbfiltr.c.
+
+--*/
+#ifndef KMDF_SHIM_KBDMOU_H
+#define KMDF_SHIM_KBDMOU_H
+
+#include "ntddk.h"
+
+#define METHOD_NEITHER  3
+
+#define IOCTL_INTERNAL_KEYBOARD_CONNECT     CTL_CODE(FILE_DEVICE_KEYBOARD, 0x0080, METHOD_NEITHER, FILE_ANY_ACCESS)
+#define IOCTL_INTERNAL_KEYBOARD_DISCONNECT  CTL_CODE(FILE_DEVICE_KEYBOARD, 0x0100, METHOD_NEITHER, FILE_ANY_ACCESS)
+#define IOCTL_INTERNAL_KEYBOARD_ENABLE      CTL_CODE(FILE_DEVICE_KEYBOARD, 0x0200, METHOD_NEITHER, FILE_ANY_ACCESS)
+#define IOCTL_INTERNAL_KEYBOARD_DISABLE     CTL_CODE(FILE_DEVICE_KEYBOARD, 0x0400, METHOD_NEITHER, FILE_ANY_ACCESS)
+
+typedef struct _CONNECT_DATA {
+    PDEVICE_OBJECT ClassDeviceObject;
+    PVOID ClassService;
+} CONNECT_DATA, *PCONNECT_DATA;
+
+typedef VOID (*PSERVICE_CALLBACK_ROUTINE)(PVOID NormalContext, PVOID SystemArgument1,
+                                          PVOID SystemArgument2, PVOID SystemArgument3);
+
+#endif
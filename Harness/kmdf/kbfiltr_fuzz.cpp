@@ -0,0 +1,99 @@
+// libFuzzer target for kbfiltr.c's request handling, run in-process
+// through the KMDF shim.
+//
+// Input layout:
+//   byte 0      bit 0: internal (default queue) vs. RawPDO queue
+//               bit 1: connect a well-formed class service first
+//               bit 2: make WdfRequestSend fail
+//               bits 3-7: IOCTL, indexing kIoctls (out of range: next 4
+//               bytes are taken as a raw IOCTL code)
+//   bytes 1-2   output buffer length, little-endian, modulo 1024
+//   byte 3      input buffer length
+//   ...         input buffer contents, then keyboard packets (12 bytes
+//               each) fed through KbFilter_ServiceCallback when connected,
+//               then the holdback timer
+//
+// Each input runs against a freshly loaded driver and device.
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "kmdf_shim.h"
+
+namespace {
+
+const ULONG kIoctls[] = {
+    IOCTL_KBFILTR_GET_KEYBOARD_ATTRIBUTES,
+    IOCTL_SET_PROBABILITY,
+    IOCTL_INTERNAL_KEYBOARD_CONNECT,
+    IOCTL_INTERNAL_KEYBOARD_DISCONNECT,
+    IOCTL_KEYBOARD_QUERY_ATTRIBUTES,
+    IOCTL_KEYBOARD_QUERY_INDICATOR_TRANSLATION,
+    IOCTL_KEYBOARD_QUERY_INDICATORS,
+    IOCTL_KEYBOARD_SET_INDICATORS,
+    IOCTL_KEYBOARD_QUERY_TYPEMATIC,
+    IOCTL_KEYBOARD_SET_TYPEMATIC,
+    IOCTL_KBFILTR_PERSIST_CONFIG,
+    IOCTL_KBFILTR_GET_HISTOGRAM,
+};
+
+}  // namespace
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+    if (size < 4) {
+        return 0;
+    }
+
+    WDFDEVICE device = kmdf::StartDevice();
+    if (device == nullptr) {
+        return 0;
+    }
+    kmdf::Class().recording = false;
+
+    uint8_t control = data[0];
+    size_t outputLength = (data[1] | (data[2] << 8)) % 1024;
+    size_t inputLength = data[3];
+    data += 4;
+    size -= 4;
+
+    kmdf::Request request;
+    request.internal = (control & 1) != 0;
+    size_t pick = control >> 3;
+    if (pick < sizeof(kIoctls) / sizeof(kIoctls[0])) {
+        request.ioctl = kIoctls[pick];
+    } else if (size >= 4) {
+        std::memcpy(&request.ioctl, data, 4);
+        data += 4;
+        size -= 4;
+    }
+
+    CONNECT_DATA connect = {};
+    bool connected = (control & 2) != 0 && kmdf::Connect(device, &connect);
+
+    inputLength = std::min(inputLength, size);
+    request.input.assign(data, data + inputLength);
+    request.output.resize(outputLength);
+    data += inputLength;
+    size -= inputLength;
+
+    if (control & 4) {
+        kmdf::SetSendFailure(STATUS_INVALID_DEVICE_REQUEST);
+    }
+    kmdf::Dispatch(request.internal ? kmdf::InternalQueue(device) : kmdf::RawPdoQueue(device), request);
+    kmdf::SetSendFailure(STATUS_SUCCESS);
+
+    if (connected && size >= sizeof(KEYBOARD_INPUT_DATA)) {
+        std::vector<KEYBOARD_INPUT_DATA> packets(size / sizeof(KEYBOARD_INPUT_DATA));
+        std::memcpy(packets.data(), data, packets.size() * sizeof(KEYBOARD_INPUT_DATA));
+        ULONG consumed = kmdf::Service(connect, packets.data(), packets.data() + packets.size());
+        // Transposition may hold a make (and its break) back for the next
+        // callback; the holdback timer releases it, so every packet is
+        // delivered once it has fired
+        kmdf::FireTimers();
+        if (consumed != packets.size() || kmdf::Class().accepted != packets.size()) {
+            __builtin_trap();
+        }
+    }
+    return 0;
+}
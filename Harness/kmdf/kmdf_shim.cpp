@@ -0,0 +1,749 @@
+// Implementation of the in-process KMDF shim (see kmdf_shim.h and wdf.h).
+
+#include "kmdf_shim.h"
+
+#include <algorithm>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+
+namespace {
+
+[[noreturn]] void Fail(const char* message) {
+    std::fprintf(stderr, "kmdf shim: %s\n", message);
+    std::abort();
+}
+
+}  // namespace
+
+// Every framework object starts with this, so a WDFOBJECT can be cast to it
+struct ShimObject {
+    const WDF_OBJECT_CONTEXT_TYPE_INFO* contextType = nullptr;
+    void* context = nullptr;
+
+    ShimObject() = default;
+    ShimObject(const ShimObject&) = delete;
+    ShimObject& operator=(const ShimObject&) = delete;
+
+    void AllocateContext(PWDF_OBJECT_ATTRIBUTES attributes) {
+        if (attributes != WDF_NO_OBJECT_ATTRIBUTES && attributes->ContextTypeInfo != nullptr) {
+            contextType = attributes->ContextTypeInfo;
+            context = std::calloc(1, contextType->ContextSize);
+        }
+    }
+
+    ~ShimObject() { std::free(context); }
+};
+
+struct WDFDRIVER__ : ShimObject {
+    WDF_DRIVER_CONFIG config = {};
+};
+
+struct WDFIOTARGET__ : ShimObject {
+};
+
+struct WDFDEVICE_INIT {
+    BOOLEAN filter = FALSE;
+    ULONG deviceType = 0;
+};
+
+struct WDFQUEUE__ : ShimObject {
+    WDFDEVICE device = nullptr;
+    WDF_IO_QUEUE_CONFIG config = {};
+    WDF_EXECUTION_LEVEL executionLevel = WdfExecutionLevelInheritFromParent;
+};
+
+struct WDFTIMER__ : ShimObject {
+    WDFDEVICE parent = nullptr;
+    WDF_TIMER_CONFIG config = {};
+    bool armed = false;
+    LONGLONG dueTime = 0;
+};
+
+struct WDFSPINLOCK__ : ShimObject {
+    bool held = false;
+};
+
+struct WDFDEVICE__ : ShimObject {
+    DEVICE_OBJECT wdm = {};
+    WDFIOTARGET__ target;
+    std::vector<std::unique_ptr<WDFQUEUE__>> queues;
+    std::vector<std::unique_ptr<WDFTIMER__>> timers;
+    std::vector<std::unique_ptr<WDFSPINLOCK__>> spinLocks;
+};
+
+struct WDFKEY__ : ShimObject {
+    ACCESS_MASK access = 0;
+};
+
+struct WDFMEMORY__ : ShimObject {
+    unsigned char* data = nullptr;
+    size_t length = 0;
+};
+
+struct WDFREQUEST__ : ShimObject {
+    kmdf::Request* owner = nullptr;
+    WDFMEMORY__ inputMemory;
+    WDFMEMORY__ outputMemory;
+    PFN_WDF_REQUEST_COMPLETION_ROUTINE completionRoutine = nullptr;
+    WDFCONTEXT completionContext = nullptr;
+    ULONG formattedIoctl = 0;
+    WDFMEMORY formattedOutput = nullptr;
+    NTSTATUS sendStatus = STATUS_SUCCESS;
+};
+
+namespace {
+
+struct RegistryValue {
+    ULONG type = 0;
+    std::vector<unsigned char> data;
+};
+
+struct ShimState {
+    DRIVER_OBJECT driverObject = {};
+    std::unique_ptr<WDFDRIVER__> driver;
+    std::map<std::wstring, RegistryValue> parameters;
+    std::vector<std::unique_ptr<WDFKEY__>> keys;
+    std::vector<std::unique_ptr<WDFDEVICE__>> devices;
+    kmdf::LowerHandler lower;
+    kmdf::ClassDriver classDriver;
+    NTSTATUS sendFailure = STATUS_SUCCESS;
+    LONGLONG systemTime = 0;
+};
+
+ShimState& State() {
+    static ShimState state;
+    return state;
+}
+
+NTSTATUS DefaultLower(ULONG ioctl, void* output, size_t outputLength, ULONG_PTR* information) {
+    if (ioctl == IOCTL_KEYBOARD_QUERY_ATTRIBUTES) {
+        if (outputLength < sizeof(KEYBOARD_ATTRIBUTES)) {
+            return STATUS_BUFFER_TOO_SMALL;
+        }
+        KEYBOARD_ATTRIBUTES attributes = {};
+        attributes.KeyboardIdentifier.Type = 4;     // 101/102-key enhanced
+        attributes.KeyboardMode = 1;
+        attributes.NumberOfFunctionKeys = 12;
+        attributes.NumberOfIndicators = 3;
+        attributes.NumberOfKeysTotal = 101;
+        attributes.InputDataQueueLength = 100;
+        std::memcpy(output, &attributes, sizeof(attributes));
+        *information = sizeof(attributes);
+    }
+    return STATUS_SUCCESS;
+}
+
+WDFREQUEST__* Live(WDFREQUEST request) {
+    if (request->owner->completed) {
+        Fail("request used after completion");
+    }
+    return request;
+}
+
+std::wstring WideString(PCUNICODE_STRING name) {
+    return std::wstring(name->Buffer, name->Length / sizeof(WCHAR));
+}
+
+WDFKEY__* OpenKey(WDFKEY key) {
+    for (auto& open : State().keys) {
+        if (open.get() == key) {
+            return key;
+        }
+    }
+    Fail("registry key used after close");
+}
+
+// Timers and spin locks must name their device as the parent
+WDFDEVICE__* ParentDevice(PWDF_OBJECT_ATTRIBUTES attributes) {
+    if (attributes != WDF_NO_OBJECT_ATTRIBUTES) {
+        for (auto& device : State().devices) {
+            if (device.get() == attributes->ParentObject) {
+                return device.get();
+            }
+        }
+    }
+    Fail("object created without a device parent");
+}
+
+VOID ClassService(PVOID DeviceObject, PVOID InputDataStart, PVOID InputDataEnd, PVOID InputDataConsumed) {
+    (void)DeviceObject;
+    kmdf::ClassDriver& driver = State().classDriver;
+    PKEYBOARD_INPUT_DATA start = (PKEYBOARD_INPUT_DATA)InputDataStart;
+    size_t count = std::min((size_t)((PKEYBOARD_INPUT_DATA)InputDataEnd - start), driver.capacity);
+    driver.capacity -= count;
+    driver.accepted += count;
+    if (driver.recording) {
+        driver.packets.insert(driver.packets.end(), start, start + count);
+    }
+    *(PULONG)InputDataConsumed = (ULONG)count;
+}
+
+void Complete(WDFREQUEST request, NTSTATUS status, ULONG_PTR information) {
+    Live(request);
+    request->owner->completed = true;
+    request->owner->status = status;
+    request->owner->information = information;
+}
+
+}  // namespace
+
+namespace kmdf {
+
+void Reset() {
+    ShimState& state = State();
+    state.devices.clear();
+    if (state.driver && state.driver->config.EvtDriverUnload != nullptr) {
+        state.driver->config.EvtDriverUnload(state.driver.get());
+    }
+    state.driver.reset();
+    state.keys.clear();
+    state.lower = DefaultLower;
+    state.classDriver = kmdf::ClassDriver();
+    state.sendFailure = STATUS_SUCCESS;
+    state.systemTime = 132000000000000000LL;    // fixed start, 100ns units
+}
+
+NTSTATUS LoadDriver() {
+    static WCHAR path[] = L"\\Registry\\Machine\\System\\CurrentControlSet\\Services\\Kbddriver";
+    UNICODE_STRING registryPath = { (USHORT)(wcslen(path) * sizeof(WCHAR)),
+                                    (USHORT)sizeof(path), path };
+    if (!State().lower) {
+        Reset();
+    }
+    return DriverEntry(&State().driverObject, &registryPath);
+}
+
+WDFDEVICE AddDevice(NTSTATUS* status) {
+    ShimState& state = State();
+    if (!state.driver) {
+        Fail("AddDevice before LoadDriver");
+    }
+    size_t before = state.devices.size();
+    WDFDEVICE_INIT init;
+    *status = state.driver->config.EvtDriverDeviceAdd(state.driver.get(), &init);
+    return (state.devices.size() > before) ? state.devices.back().get() : nullptr;
+}
+
+void SetParameter(const std::wstring& name, ULONG type, const std::vector<unsigned char>& data) {
+    State().parameters[name] = RegistryValue{ type, data };
+}
+
+bool GetParameter(const std::wstring& name, ULONG* type, std::vector<unsigned char>* data) {
+    auto found = State().parameters.find(name);
+    if (found == State().parameters.end()) {
+        return false;
+    }
+    *type = found->second.type;
+    *data = found->second.data;
+    return true;
+}
+
+void ClearParameters() {
+    State().parameters.clear();
+}
+
+size_t OpenKeys() {
+    return State().keys.size();
+}
+
+void SetLowerHandler(LowerHandler handler) {
+    State().lower = std::move(handler);
+}
+
+size_t FireTimers() {
+    std::vector<WDFTIMER__*> due;
+    for (auto& device : State().devices) {
+        for (auto& timer : device->timers) {
+            if (timer->armed) {
+                due.push_back(timer.get());
+            }
+        }
+    }
+    for (WDFTIMER__* timer : due) {
+        timer->armed = false;
+        timer->config.EvtTimerFunc(timer);
+    }
+    return due.size();
+}
+
+size_t ArmedTimers() {
+    size_t armed = 0;
+    for (auto& device : State().devices) {
+        for (auto& timer : device->timers) {
+            armed += timer->armed;
+        }
+    }
+    return armed;
+}
+
+void SetSendFailure(NTSTATUS status) {
+    State().sendFailure = status;
+}
+
+WDFQUEUE InternalQueue(WDFDEVICE device) {
+    for (auto& queue : device->queues) {
+        if (queue->config.DefaultQueue) {
+            return queue.get();
+        }
+    }
+    return nullptr;
+}
+
+WDFQUEUE RawPdoQueue(WDFDEVICE device) {
+    for (auto& queue : device->queues) {
+        if (!queue->config.DefaultQueue && queue->config.EvtIoDeviceControl != nullptr) {
+            return queue.get();
+        }
+    }
+    return nullptr;
+}
+
+WDF_EXECUTION_LEVEL QueueExecutionLevel(WDFQUEUE queue) {
+    return queue->executionLevel;
+}
+
+void Dispatch(WDFQUEUE queue, Request& request) {
+    if (!request.handle) {
+        request.handle = std::make_shared<WDFREQUEST__>();
+    }
+    WDFREQUEST__* handle = request.handle.get();
+    handle->owner = &request;
+    handle->inputMemory.data = request.input.data();
+    handle->inputMemory.length = request.input.size();
+    handle->outputMemory.data = request.output.data();
+    handle->outputMemory.length = request.output.size();
+    handle->completionRoutine = nullptr;
+    handle->completionContext = nullptr;
+    handle->formattedIoctl = request.ioctl;
+    handle->formattedOutput = nullptr;
+    handle->sendStatus = STATUS_SUCCESS;
+
+    request.completed = false;
+    request.forwarded = false;
+    request.status = STATUS_SUCCESS;
+    request.information = 0;
+
+    PFN_WDF_IO_QUEUE_IO_DEVICE_CONTROL callback = request.internal
+        ? queue->config.EvtIoInternalDeviceControl : queue->config.EvtIoDeviceControl;
+    if (callback == nullptr) {
+        Complete(handle, STATUS_INVALID_DEVICE_REQUEST, 0);
+        return;
+    }
+
+    callback(queue, handle, request.output.size(), request.input.size(), request.ioctl);
+
+    if (!request.completed) {
+        Fail("request neither completed nor forwarded");
+    }
+}
+
+WDFDEVICE StartDevice(NTSTATUS* status) {
+    NTSTATUS ignored;
+    if (status == nullptr) {
+        status = &ignored;
+    }
+    Reset();
+    ClearParameters();
+    *status = LoadDriver();
+    return NT_SUCCESS(*status) ? AddDevice(status) : nullptr;
+}
+
+ClassDriver& Class() {
+    return State().classDriver;
+}
+
+bool Connect(WDFDEVICE device, CONNECT_DATA* connect) {
+    static DEVICE_OBJECT classDevice;
+    CONNECT_DATA data = { &classDevice, (PVOID)ClassService };
+    Request request;
+    request.ioctl = IOCTL_INTERNAL_KEYBOARD_CONNECT;
+    request.internal = true;
+    request.input.assign((unsigned char*)&data, (unsigned char*)&data + sizeof(data));
+    Dispatch(InternalQueue(device), request);
+    std::memcpy(connect, request.input.data(), sizeof(*connect));
+    return NT_SUCCESS(request.status);
+}
+
+ULONG Service(const CONNECT_DATA& connect, PKEYBOARD_INPUT_DATA start, PKEYBOARD_INPUT_DATA end) {
+    ULONG consumed = 0;
+    ((PSERVICE_CALLBACK_ROUTINE)(ULONG_PTR)connect.ClassService)(connect.ClassDeviceObject, start, end, &consumed);
+    return consumed;
+}
+
+NTSTATUS SetConfig(WDFDEVICE device, const void* config, size_t length) {
+    Request request;
+    request.ioctl = IOCTL_SET_PROBABILITY;
+    request.input.assign((const unsigned char*)config, (const unsigned char*)config + length);
+    Dispatch(RawPdoQueue(device), request);
+    return request.status;
+}
+
+}  // namespace kmdf
+
+extern "C" {
+
+ULONG DbgPrint(const char* Format, ...) {
+    if (std::getenv("KMDF_SHIM_TRACE") != nullptr) {
+        va_list args;
+        va_start(args, Format);
+        std::vfprintf(stderr, Format, args);
+        va_end(args);
+    }
+    return 0;
+}
+
+VOID KeQuerySystemTime(PLARGE_INTEGER CurrentTime) {
+    CurrentTime->QuadPart = State().systemTime;
+    State().systemTime += 10000;
+}
+
+NTSTATUS KeDelayExecutionThread(KPROCESSOR_MODE WaitMode, BOOLEAN Alertable, PLARGE_INTEGER Interval) {
+    UNREFERENCED_PARAMETER(WaitMode);
+    UNREFERENCED_PARAMETER(Alertable);
+    UNREFERENCED_PARAMETER(Interval);
+    return STATUS_SUCCESS;
+}
+
+PVOID ExAllocatePoolWithTag(POOL_TYPE PoolType, size_t NumberOfBytes, ULONG Tag) {
+    UNREFERENCED_PARAMETER(PoolType);
+    UNREFERENCED_PARAMETER(Tag);
+    return std::malloc(NumberOfBytes);
+}
+
+VOID ExFreePoolWithTag(PVOID P, ULONG Tag) {
+    UNREFERENCED_PARAMETER(Tag);
+    std::free(P);
+}
+
+PVOID WdfObjectGetTypedContextWorker(WDFOBJECT Handle, const WDF_OBJECT_CONTEXT_TYPE_INFO* TypeInfo) {
+    ShimObject* object = static_cast<ShimObject*>(Handle);
+    if (object->contextType == nullptr ||
+        std::strcmp(object->contextType->ContextName, TypeInfo->ContextName) != 0) {
+        Fail("object has no context of the requested type");
+    }
+    return object->context;
+}
+
+NTSTATUS WdfDriverCreate(PDRIVER_OBJECT DriverObject, PCUNICODE_STRING RegistryPath,
+                         PWDF_OBJECT_ATTRIBUTES DriverAttributes, PWDF_DRIVER_CONFIG DriverConfig,
+                         WDFDRIVER* Driver) {
+    UNREFERENCED_PARAMETER(RegistryPath);
+    ShimState& state = State();
+    state.devices.clear();
+    state.driver = std::make_unique<WDFDRIVER__>();
+    state.driver->config = *DriverConfig;
+    state.driver->AllocateContext(DriverAttributes);
+    DriverObject->ShimDriver = state.driver.get();
+    if (Driver != WDF_NO_HANDLE) {
+        *Driver = state.driver.get();
+    }
+    return STATUS_SUCCESS;
+}
+
+WDFDRIVER WdfGetDriver(void) {
+    return State().driver.get();
+}
+
+NTSTATUS WdfDriverOpenParametersRegistryKey(WDFDRIVER Driver, ACCESS_MASK DesiredAccess,
+                                            PWDF_OBJECT_ATTRIBUTES KeyAttributes, WDFKEY* Key) {
+    if (Driver == nullptr || Driver != State().driver.get()) {
+        Fail("registry key opened without a driver");
+    }
+    auto key = std::make_unique<WDFKEY__>();
+    key->access = DesiredAccess;
+    key->AllocateContext(KeyAttributes);
+    *Key = key.get();
+    State().keys.push_back(std::move(key));
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS WdfRegistryQueryValue(WDFKEY Key, PCUNICODE_STRING ValueName, ULONG ValueLength,
+                               PVOID Value, PULONG ValueLengthQueried, PULONG ValueType) {
+    OpenKey(Key);
+    auto found = State().parameters.find(WideString(ValueName));
+    if (found == State().parameters.end()) {
+        return STATUS_OBJECT_NAME_NOT_FOUND;
+    }
+    const RegistryValue& value = found->second;
+    if (ValueLengthQueried != nullptr) {
+        *ValueLengthQueried = (ULONG)value.data.size();
+    }
+    if (ValueType != nullptr) {
+        *ValueType = value.type;
+    }
+    if (value.data.size() > ValueLength) {
+        return STATUS_BUFFER_OVERFLOW;
+    }
+    if (!value.data.empty()) {
+        std::memcpy(Value, value.data.data(), value.data.size());
+    }
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS WdfRegistryAssignValue(WDFKEY Key, PCUNICODE_STRING ValueName, ULONG ValueType,
+                                ULONG ValueLength, PVOID Value) {
+    if ((OpenKey(Key)->access & KEY_WRITE) != KEY_WRITE) {
+        Fail("registry key written without KEY_WRITE");
+    }
+    const unsigned char* bytes = static_cast<const unsigned char*>(Value);
+    State().parameters[WideString(ValueName)] =
+        RegistryValue{ ValueType, std::vector<unsigned char>(bytes, bytes + ValueLength) };
+    return STATUS_SUCCESS;
+}
+
+VOID WdfRegistryClose(WDFKEY Key) {
+    auto& keys = State().keys;
+    for (auto it = keys.begin(); it != keys.end(); ++it) {
+        if (it->get() == Key) {
+            keys.erase(it);
+            return;
+        }
+    }
+    Fail("registry key closed twice");
+}
+
+VOID WdfFdoInitSetFilter(PWDFDEVICE_INIT DeviceInit) {
+    DeviceInit->filter = TRUE;
+}
+
+VOID WdfDeviceInitSetDeviceType(PWDFDEVICE_INIT DeviceInit, ULONG DeviceType) {
+    DeviceInit->deviceType = DeviceType;
+}
+
+NTSTATUS WdfDeviceCreate(PWDFDEVICE_INIT* DeviceInit, PWDF_OBJECT_ATTRIBUTES DeviceAttributes,
+                         WDFDEVICE* Device) {
+    auto device = std::make_unique<WDFDEVICE__>();
+    device->AllocateContext(DeviceAttributes);
+    device->wdm.DeviceExtension = device->context;
+    device->wdm.ShimDevice = device.get();
+    *Device = device.get();
+    *DeviceInit = nullptr;
+    State().devices.push_back(std::move(device));
+    return STATUS_SUCCESS;
+}
+
+PDEVICE_OBJECT WdfDeviceWdmGetDeviceObject(WDFDEVICE Device) {
+    return &Device->wdm;
+}
+
+WDFDEVICE WdfWdmDeviceGetWdfDeviceHandle(PDEVICE_OBJECT DeviceObject) {
+    return static_cast<WDFDEVICE>(DeviceObject->ShimDevice);
+}
+
+WDFIOTARGET WdfDeviceGetIoTarget(WDFDEVICE Device) {
+    return &Device->target;
+}
+
+NTSTATUS WdfIoQueueCreate(WDFDEVICE Device, PWDF_IO_QUEUE_CONFIG Config,
+                          PWDF_OBJECT_ATTRIBUTES QueueAttributes, WDFQUEUE* Queue) {
+    if (Config->DefaultQueue && kmdf::InternalQueue(Device) != nullptr) {
+        return STATUS_INVALID_DEVICE_REQUEST;
+    }
+    auto queue = std::make_unique<WDFQUEUE__>();
+    queue->device = Device;
+    queue->config = *Config;
+    queue->AllocateContext(QueueAttributes);
+    if (QueueAttributes != WDF_NO_OBJECT_ATTRIBUTES) {
+        queue->executionLevel = QueueAttributes->ExecutionLevel;
+    }
+    if (Queue != WDF_NO_HANDLE) {
+        *Queue = queue.get();
+    }
+    Device->queues.push_back(std::move(queue));
+    return STATUS_SUCCESS;
+}
+
+WDFDEVICE WdfIoQueueGetDevice(WDFQUEUE Queue) {
+    return Queue->device;
+}
+
+NTSTATUS WdfTimerCreate(PWDF_TIMER_CONFIG Config, PWDF_OBJECT_ATTRIBUTES Attributes, WDFTIMER* Timer) {
+    WDFDEVICE__* parent = ParentDevice(Attributes);
+    auto timer = std::make_unique<WDFTIMER__>();
+    timer->parent = parent;
+    timer->config = *Config;
+    timer->AllocateContext(Attributes);
+    *Timer = timer.get();
+    parent->timers.push_back(std::move(timer));
+    return STATUS_SUCCESS;
+}
+
+BOOLEAN WdfTimerStart(WDFTIMER Timer, LONGLONG DueTime) {
+    BOOLEAN wasArmed = Timer->armed ? TRUE : FALSE;
+    Timer->armed = true;
+    Timer->dueTime = DueTime;
+    return wasArmed;
+}
+
+BOOLEAN WdfTimerStop(WDFTIMER Timer, BOOLEAN Wait) {
+    UNREFERENCED_PARAMETER(Wait);
+    BOOLEAN wasArmed = Timer->armed ? TRUE : FALSE;
+    Timer->armed = false;
+    return wasArmed;
+}
+
+WDFOBJECT WdfTimerGetParentObject(WDFTIMER Timer) {
+    return Timer->parent;
+}
+
+NTSTATUS WdfSpinLockCreate(PWDF_OBJECT_ATTRIBUTES SpinLockAttributes, WDFSPINLOCK* SpinLock) {
+    WDFDEVICE__* parent = ParentDevice(SpinLockAttributes);
+    auto lock = std::make_unique<WDFSPINLOCK__>();
+    *SpinLock = lock.get();
+    parent->spinLocks.push_back(std::move(lock));
+    return STATUS_SUCCESS;
+}
+
+VOID WdfSpinLockAcquire(WDFSPINLOCK SpinLock) {
+    if (SpinLock->held) {
+        Fail("spin lock acquired while held");
+    }
+    SpinLock->held = true;
+}
+
+VOID WdfSpinLockRelease(WDFSPINLOCK SpinLock) {
+    if (!SpinLock->held) {
+        Fail("spin lock released while not held");
+    }
+    SpinLock->held = false;
+}
+
+NTSTATUS WdfMemoryCopyFromBuffer(WDFMEMORY DestinationMemory, size_t DestinationOffset,
+                                 PVOID Buffer, size_t NumBytesToCopyFrom) {
+    if (DestinationOffset > DestinationMemory->length ||
+        NumBytesToCopyFrom > DestinationMemory->length - DestinationOffset) {
+        return STATUS_INVALID_BUFFER_SIZE;
+    }
+    std::memcpy(DestinationMemory->data + DestinationOffset, Buffer, NumBytesToCopyFrom);
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS WdfMemoryCopyToBuffer(WDFMEMORY SourceMemory, size_t SourceOffset, PVOID Buffer,
+                               size_t NumBytesToCopyTo) {
+    if (SourceOffset > SourceMemory->length ||
+        NumBytesToCopyTo > SourceMemory->length - SourceOffset) {
+        return STATUS_INVALID_BUFFER_SIZE;
+    }
+    std::memcpy(Buffer, SourceMemory->data + SourceOffset, NumBytesToCopyTo);
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS WdfRequestRetrieveInputBuffer(WDFREQUEST Request, size_t MinimumRequiredSize,
+                                       PVOID* Buffer, size_t* Length) {
+    WDFMEMORY__& memory = Live(Request)->inputMemory;
+    if (memory.length == 0 || memory.length < MinimumRequiredSize) {
+        return STATUS_BUFFER_TOO_SMALL;
+    }
+    *Buffer = memory.data;
+    if (Length != nullptr) {
+        *Length = memory.length;
+    }
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS WdfRequestRetrieveOutputBuffer(WDFREQUEST Request, size_t MinimumRequiredSize,
+                                        PVOID* Buffer, size_t* Length) {
+    WDFMEMORY__& memory = Live(Request)->outputMemory;
+    if (memory.length == 0 || memory.length < MinimumRequiredSize) {
+        return STATUS_BUFFER_TOO_SMALL;
+    }
+    *Buffer = memory.data;
+    if (Length != nullptr) {
+        *Length = memory.length;
+    }
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS WdfRequestRetrieveOutputMemory(WDFREQUEST Request, WDFMEMORY* Memory) {
+    WDFMEMORY__& memory = Live(Request)->outputMemory;
+    if (memory.length == 0) {
+        return STATUS_BUFFER_TOO_SMALL;
+    }
+    *Memory = &memory;
+    return STATUS_SUCCESS;
+}
+
+VOID WdfRequestComplete(WDFREQUEST Request, NTSTATUS Status) {
+    Complete(Request, Status, 0);
+}
+
+VOID WdfRequestCompleteWithInformation(WDFREQUEST Request, NTSTATUS Status, ULONG_PTR Information) {
+    Complete(Request, Status, Information);
+}
+
+NTSTATUS WdfRequestGetStatus(WDFREQUEST Request) {
+    return Request->sendStatus;
+}
+
+VOID WdfRequestSetCompletionRoutine(WDFREQUEST Request,
+                                    PFN_WDF_REQUEST_COMPLETION_ROUTINE CompletionRoutine,
+                                    WDFCONTEXT CompletionContext) {
+    Live(Request)->completionRoutine = CompletionRoutine;
+    Request->completionContext = CompletionContext;
+}
+
+NTSTATUS WdfIoTargetFormatRequestForInternalIoctl(WDFIOTARGET IoTarget, WDFREQUEST Request,
+                                                  ULONG IoctlCode, WDFMEMORY InputBuffer,
+                                                  size_t* InputBufferOffset,
+                                                  WDFMEMORY OutputBuffer,
+                                                  size_t* OutputBufferOffset) {
+    UNREFERENCED_PARAMETER(IoTarget);
+    UNREFERENCED_PARAMETER(InputBuffer);
+    UNREFERENCED_PARAMETER(InputBufferOffset);
+    UNREFERENCED_PARAMETER(OutputBufferOffset);
+    Live(Request)->formattedIoctl = IoctlCode;
+    Request->formattedOutput = OutputBuffer;
+    return STATUS_SUCCESS;
+}
+
+BOOLEAN WdfRequestSend(WDFREQUEST Request, WDFIOTARGET Target, PWDF_REQUEST_SEND_OPTIONS Options) {
+    ShimState& state = State();
+    kmdf::Request& owner = *Live(Request)->owner;
+
+    if (state.sendFailure != STATUS_SUCCESS) {
+        Request->sendStatus = state.sendFailure;
+        return FALSE;
+    }
+
+    ULONG_PTR information = 0;
+    NTSTATUS status = state.lower(Request->formattedIoctl, owner.output.data(), owner.output.size(),
+                                  &information);
+    owner.forwarded = true;
+
+    if ((Options != WDF_NO_SEND_OPTIONS && (Options->Flags & WDF_REQUEST_SEND_OPTION_SEND_AND_FORGET)) ||
+        Request->completionRoutine == nullptr) {
+        Complete(Request, status, information);
+        return TRUE;
+    }
+
+    WDF_REQUEST_COMPLETION_PARAMS params = {};
+    params.Size = sizeof(params);
+    params.Type = owner.internal ? WdfRequestTypeDeviceControlInternal : WdfRequestTypeDeviceControl;
+    params.IoStatus.Status = status;
+    params.IoStatus.Information = information;
+    params.Parameters.Ioctl.IoControlCode = Request->formattedIoctl;
+    params.Parameters.Ioctl.Output.Buffer = Request->formattedOutput;
+    params.Parameters.Ioctl.Output.Offset = 0;
+    params.Parameters.Ioctl.Output.Length =
+        Request->formattedOutput != nullptr ? Request->formattedOutput->length : 0;
+
+    Request->completionRoutine(Request, Target, &params, Request->completionContext);
+
+    if (!owner.completed) {
+        Fail("completion routine did not complete the request");
+    }
+    return TRUE;
+}
+
+// rawpdo.c is not part of the shim build; the RawPDO's only job is to
+// forward IOCTLs to RawPdoQueue, which the harness dispatches to directly.
+NTSTATUS KbFiltr_CreateRawPdo(WDFDEVICE Device, ULONG InstanceNo) {
+    UNREFERENCED_PARAMETER(Device);
+    UNREFERENCED_PARAMETER(InstanceNo);
+    return STATUS_SUCCESS;
+}
+
+}  // extern "C"
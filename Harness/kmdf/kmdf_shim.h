@@ -0,0 +1,129 @@
+// In-process KMDF shim: lets the unmodified kbfiltr.c run in a Linux
+// process. The driver sees the WDF calls declared in wdf.h; the harness
+// drives it through the functions below, playing the role of the PnP
+// manager, the I/O manager, the lower keyboard driver and kbdclass.
+//
+// Everything is single-threaded and synchronous: a dispatched request is
+// either completed by the driver or forwarded to the IO target, which
+// completes it (and runs any completion routine) before Dispatch returns.
+// Completing a request twice, or touching it after completion, aborts.
+
+#ifndef KMDF_SHIM_H
+#define KMDF_SHIM_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+extern "C" {
+#include "kbfiltr.h"
+}
+
+namespace kmdf {
+
+// Lower driver: handles forwarded requests. Output is the caller's output
+// buffer (may be empty); return the completion status and set *information.
+using LowerHandler = std::function<NTSTATUS(ULONG ioctl, void* output, size_t outputLength,
+                                            ULONG_PTR* information)>;
+
+struct Request {
+    ULONG ioctl = 0;
+    bool internal = false;
+    std::vector<unsigned char> input;
+    std::vector<unsigned char> output;
+
+    // Set when the request is completed, by the driver or the IO target
+    bool completed = false;
+    bool forwarded = false;
+    NTSTATUS status = 0;
+    ULONG_PTR information = 0;
+
+    // Framework object, created on first dispatch and reused after
+    std::shared_ptr<WDFREQUEST__> handle;
+};
+
+// The class driver a connected device reports to. It takes up to capacity
+// packets and then stops, as kbdclass does when its buffer is full; what
+// it takes is counted in accepted and, while recording, kept in packets.
+struct ClassDriver {
+    size_t capacity = SIZE_MAX;
+    size_t accepted = 0;
+    bool recording = true;
+    std::vector<KEYBOARD_INPUT_DATA> packets;
+};
+
+// Unloads the driver (EvtDriverUnload, if it registered one), tears down
+// every object and resets the lower driver to the default, which answers
+// IOCTL_KEYBOARD_QUERY_ATTRIBUTES and succeeds the rest, and the class
+// driver to its defaults.
+// The Parameters key survives, so Reset + LoadDriver models a reboot.
+void Reset();
+
+// The driver's Parameters registry key
+void SetParameter(const std::wstring& name, ULONG type, const std::vector<unsigned char>& data);
+bool GetParameter(const std::wstring& name, ULONG* type, std::vector<unsigned char>* data);
+void ClearParameters();
+
+// Registry keys the driver opened and has not closed yet
+size_t OpenKeys();
+
+// LoadDriver runs DriverEntry; AddDevice runs EvtDriverDeviceAdd for one
+// new device and returns it (NULL if none was created)
+NTSTATUS LoadDriver();
+WDFDEVICE AddDevice(NTSTATUS* status);
+
+void SetLowerHandler(LowerHandler handler);
+
+// Runs the callback of every started timer once, stopping it first as a
+// one-shot timer would be; returns how many fired
+size_t FireTimers();
+size_t ArmedTimers();
+
+// Makes WdfRequestSend fail with status (STATUS_SUCCESS restores success)
+void SetSendFailure(NTSTATUS status);
+
+// The device's default queue (internal IOCTLs from the keyboard stack)
+// and the queue the RawPDO forwards its IOCTLs to
+WDFQUEUE InternalQueue(WDFDEVICE device);
+WDFQUEUE RawPdoQueue(WDFDEVICE device);
+
+// The ExecutionLevel the queue was created with (InheritFromParent when
+// it was created without attributes)
+WDF_EXECUTION_LEVEL QueueExecutionLevel(WDFQUEUE queue);
+
+// Presents the request to the queue's handler. The request object is
+// reusable: Dispatch clears its completion state first.
+void Dispatch(WDFQUEUE queue, Request& request);
+
+//
+// Shortcuts for the harness programs, built on the calls above
+//
+
+// Reset, ClearParameters, LoadDriver and AddDevice: a freshly installed
+// driver with one device. NULL, with *status set, if either step failed.
+WDFDEVICE StartDevice(NTSTATUS* status = nullptr);
+
+ClassDriver& Class();
+
+// Connects the device to Class() with IOCTL_INTERNAL_KEYBOARD_CONNECT.
+// On success *connect is what the driver passed down in its place: its
+// ClassService is the hooked service callback.
+bool Connect(WDFDEVICE device, CONNECT_DATA* connect);
+
+// Calls the hooked service callback as the port driver would; returns
+// how many packets it consumed
+ULONG Service(const CONNECT_DATA& connect, PKEYBOARD_INPUT_DATA start, PKEYBOARD_INPUT_DATA end);
+
+// IOCTL_SET_PROBABILITY on the RawPDO queue with length bytes of config
+NTSTATUS SetConfig(WDFDEVICE device, const void* config, size_t length);
+
+inline NTSTATUS SetConfig(WDFDEVICE device, const KB_CONFIG& config) {
+    return SetConfig(device, &config, sizeof(config));
+}
+
+}  // namespace kmdf
+
+#endif
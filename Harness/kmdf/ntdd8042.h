@@ -0,0 +1,18 @@
+/*++
+
+Module Name:
+
+    ntdd8042.h (kmdf shim)
+
+Abstract:
+
+    Nothing from the i8042 port interface is used by kbfiltr.c; this
+    header only satisfies its include.
+
+--*/
+#ifndef KMDF_SHIM_NTDD8042_H
+#define KMDF_SHIM_NTDD8042_H
+
+#include "ntddk.h"
+
+#endif
@@ -0,0 +1,134 @@
+/*++
+
+Module Name:
+
+    ntddk.h (kmdf shim)
+
+Abstract:
+
+    User-mode stand-in for the subset of ntddk.h that kbfiltr.c uses.
+    Part of the in-process KMDF shim; see kmdf_shim.h.
+
+--*/
+#ifndef KMDF_SHIM_NTDDK_H
+#define KMDF_SHIM_NTDDK_H
+
+#include <assert.h>
+#include <wchar.h>
+
+#include "kbport.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef wchar_t WCHAR, *PWCH, *PWSTR;
+typedef const wchar_t *PCWSTR;
+
+typedef struct _UNICODE_STRING {
+    USHORT Length;
+    USHORT MaximumLength;
+    PWCH Buffer;
+} UNICODE_STRING, *PUNICODE_STRING;
+typedef const UNICODE_STRING *PCUNICODE_STRING;
+
+#define DECLARE_CONST_UNICODE_STRING(_var, _string)                 \
+    const WCHAR _var##_buffer[] = _string;                          \
+    const UNICODE_STRING _var = { sizeof(_string) - sizeof(WCHAR),  \
+                                  sizeof(_string), (PWCH)_var##_buffer }
+
+typedef union _LARGE_INTEGER {
+    struct {
+        ULONG LowPart;
+        LONG HighPart;
+    };
+    LONGLONG QuadPart;
+} LARGE_INTEGER, *PLARGE_INTEGER;
+
+typedef struct _GUID {
+    ULONG Data1;
+    USHORT Data2;
+    USHORT Data3;
+    UCHAR Data4[8];
+} GUID;
+
+typedef struct _IO_STATUS_BLOCK {
+    NTSTATUS Status;
+    ULONG_PTR Information;
+} IO_STATUS_BLOCK, *PIO_STATUS_BLOCK;
+
+// ShimDevice links back to the owning WDFDEVICE
+typedef struct _DEVICE_OBJECT {
+    PVOID DeviceExtension;
+    PVOID ShimDevice;
+} DEVICE_OBJECT, *PDEVICE_OBJECT;
+
+typedef struct _DRIVER_OBJECT {
+    PVOID ShimDriver;
+} DRIVER_OBJECT, *PDRIVER_OBJECT;
+
+typedef NTSTATUS DRIVER_INITIALIZE(PDRIVER_OBJECT DriverObject, PUNICODE_STRING RegistryPath);
+
+#define STATUS_SUCCESS                  ((NTSTATUS)0x00000000L)
+#define STATUS_BUFFER_OVERFLOW          ((NTSTATUS)0x80000005L)
+#define STATUS_UNSUCCESSFUL             ((NTSTATUS)0xC0000001L)
+#define STATUS_NOT_IMPLEMENTED          ((NTSTATUS)0xC0000002L)
+#define STATUS_INVALID_PARAMETER        ((NTSTATUS)0xC000000DL)
+#define STATUS_INVALID_DEVICE_REQUEST   ((NTSTATUS)0xC0000010L)
+#define STATUS_BUFFER_TOO_SMALL         ((NTSTATUS)0xC0000023L)
+#define STATUS_OBJECT_NAME_NOT_FOUND    ((NTSTATUS)0xC0000034L)
+#define STATUS_SHARING_VIOLATION        ((NTSTATUS)0xC0000043L)
+#define STATUS_INSUFFICIENT_RESOURCES   ((NTSTATUS)0xC000009AL)
+#define STATUS_INVALID_BUFFER_SIZE      ((NTSTATUS)0xC0000206L)
+
+typedef ULONG ACCESS_MASK;
+#define KEY_READ                        0x20019
+#define KEY_WRITE                       0x20006
+#define REG_BINARY                      3
+
+#define NT_SUCCESS(Status) (((NTSTATUS)(Status)) >= 0)
+#define NT_ASSERT(e) assert(e)
+#define PAGED_CODE()
+
+ULONG DbgPrint(const char* Format, ...);
+
+VOID KeQuerySystemTime(PLARGE_INTEGER CurrentTime);
+
+// The shim never preempts, so a delay only has to return
+typedef char KPROCESSOR_MODE;
+#define KernelMode 0
+NTSTATUS KeDelayExecutionThread(KPROCESSOR_MODE WaitMode, BOOLEAN Alertable, PLARGE_INTEGER Interval);
+
+#define YieldProcessor() ((void)0)
+
+// Interlocked operations are full barriers, as on Windows
+FORCEINLINE LONG InterlockedIncrement(LONG volatile* Addend)
+{
+    return __atomic_add_fetch(Addend, 1, __ATOMIC_SEQ_CST);
+}
+
+FORCEINLINE LONG InterlockedDecrement(LONG volatile* Addend)
+{
+    return __atomic_sub_fetch(Addend, 1, __ATOMIC_SEQ_CST);
+}
+
+FORCEINLINE PVOID InterlockedExchangePointer(PVOID volatile* Target, PVOID Value)
+{
+    return __atomic_exchange_n(Target, Value, __ATOMIC_SEQ_CST);
+}
+
+// Pool allocations come from the C heap; the tag is not tracked
+typedef enum _POOL_TYPE {
+    NonPagedPool = 0,
+    PagedPool = 1,
+    NonPagedPoolNx = 512,
+} POOL_TYPE;
+
+PVOID ExAllocatePoolWithTag(POOL_TYPE PoolType, size_t NumberOfBytes, ULONG Tag);
+VOID ExFreePoolWithTag(PVOID P, ULONG Tag);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,18 @@
+/*++
+
+Module Name:
+
+    ntstrsafe.h (kmdf shim)
+
+Abstract:
+
+    Nothing from ntstrsafe is used by kbfiltr.c; this header only
+    satisfies its include.
+
+--*/
+#ifndef KMDF_SHIM_NTSTRSAFE_H
+#define KMDF_SHIM_NTSTRSAFE_H
+
+#include "ntddk.h"
+
+#endif
@@ -0,0 +1,419 @@
+// Monte-Carlo validator for the injection statistics of the transform engine.
+//
+// Drives KB_MODE_CHAOS over billions of simulated make codes, one worker
+// per core, and checks what the engine actually produces against what the
+// config promises:
+//
+//   injection rate      binomial z-test against Probability
+//   replacements        chi-square, uniform over AllowedScanCodes
+//   replacement pairs   chi-square, consecutive replacements independent
+//   burst lengths       chi-square, runs of injected makes ~ Geometric(1-p)
+//   gap lengths         KS, distance between injections ~ Geometric(p)
+//
+// Every make is a space (0x39), which is not a replacement candidate, so a
+// changed make code is an injection.
+//
+// The workers split one run of the engine's LCG: each stream is seeded by
+// jumping ahead to where the previous one ends, so no two streams share a
+// draw as long as the whole run fits in the 2^31 period.
+//
+// With --burst BAD,ENTER,EXIT the Gilbert-Elliott model is validated
+// instead: Probability applies in the good state, BAD (percent) in the bad
+// state, and ENTER/EXIT are the per-10000 chances of switching. Makes are
+// then fed one per call so the state can be read after each, and the
+// rate, burst and gap tests are replaced by:
+//
+//   transitions         binomial z-tests, per state, against ENTER and EXIT
+//   injection per state binomial z-tests against Probability and BAD
+//   hit / miss runs     chi-square against the run lengths of the hidden
+//                       Markov chain, P(k) = u A_o^k A_o' 1 / u A_o 1
+//
+// Usage: mc_validate [--makes N] [--probability P] [--threads N]
+//                    [--seed S] [--alpha A] [--burst BAD,ENTER,EXIT]
+//
+// Exits 1 if any test rejects at significance alpha.
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "kbcore.h"
+#include "stats.h"
+
+namespace {
+
+const USHORT kProbeCode = 0x39;
+const size_t kBatch = 4096;
+const size_t kMaxBurst = 64;
+const size_t kMaxGap = 4096;
+
+// The engine's LCG, x -> (A x + C) mod 2^31 (see KbCoreRandom)
+const uint64_t kLcgA = 1103515245;
+const uint64_t kLcgC = 12345;
+const uint64_t kLcgMask = 0x7FFFFFFF;
+const uint64_t kLcgPeriod = 0x80000000ull;
+
+// Seed after `steps` draws from `seed`, in O(log steps): squares the affine
+// map (a, c) -> (a^2, (a + 1) c) and composes the powers the bits of steps
+// select. This avoids the closed form c (a^k - 1) / (a - 1), whose division
+// has no inverse mod 2^31 since a - 1 is even.
+ULONG LcgJump(ULONG seed, uint64_t steps) {
+    uint64_t a = kLcgA, c = kLcgC;
+    uint64_t jumpA = 1, jumpC = 0;
+    for (steps %= kLcgPeriod; steps != 0; steps >>= 1) {
+        if (steps & 1) {
+            jumpA = (jumpA * a) & kLcgMask;
+            jumpC = (jumpC * a + c) & kLcgMask;
+        }
+        c = ((a + 1) * c) & kLcgMask;
+        a = (a * a) & kLcgMask;
+    }
+    return (ULONG)((jumpA * seed + jumpC) & kLcgMask);
+}
+
+struct Tally {
+    uint64_t makes = 0;
+    uint64_t injected = 0;
+    std::vector<uint64_t> replacement = std::vector<uint64_t>(ALLOWED_SCAN_CODE_COUNT);
+    std::vector<uint64_t> pairs = std::vector<uint64_t>(ALLOWED_SCAN_CODE_COUNT * ALLOWED_SCAN_CODE_COUNT);
+    std::vector<uint64_t> bursts = std::vector<uint64_t>(kMaxBurst + 1);  // last bin: >= kMaxBurst
+    std::vector<uint64_t> gaps = std::vector<uint64_t>(kMaxGap + 1);      // last bin: >= kMaxGap
+
+    // Burst mode only, indexed by state: makes that started in it and left
+    // it, and makes sampled in it and injected
+    uint64_t from[2] = {}, switched[2] = {};
+    uint64_t in[2] = {}, injectedIn[2] = {};
+
+    void Merge(const Tally& other) {
+        makes += other.makes;
+        injected += other.injected;
+        for (size_t i = 0; i < replacement.size(); i++) replacement[i] += other.replacement[i];
+        for (size_t i = 0; i < pairs.size(); i++) pairs[i] += other.pairs[i];
+        for (size_t i = 0; i < bursts.size(); i++) bursts[i] += other.bursts[i];
+        for (size_t i = 0; i < gaps.size(); i++) gaps[i] += other.gaps[i];
+        for (int s = 0; s < 2; s++) {
+            from[s] += other.from[s];
+            switched[s] += other.switched[s];
+            in[s] += other.in[s];
+            injectedIn[s] += other.injectedIn[s];
+        }
+    }
+};
+
+// Runs one independent stream. Runs still open when the stream ends are
+// not counted, so every recorded burst and gap is complete. A Gilbert-Elliott
+// profile is fed one make per call, to follow its state.
+void Simulate(const KB_PROFILE& profile, ULONG seed, uint64_t makes, Tally& tally) {
+    int index[256];
+    std::fill(std::begin(index), std::end(index), -1);
+    for (int i = 0; i < ALLOWED_SCAN_CODE_COUNT; i++) {
+        index[AllowedScanCodes[i]] = i;
+    }
+
+    KB_STREAM stream;
+    KbCoreInitStream(&stream, seed);
+    std::vector<KEYBOARD_INPUT_DATA> batch(kBatch);
+    const bool burstModel = (profile.Sample == KB_SAMPLE_BURST);
+    const size_t batchSize = burstModel ? 1 : kBatch;
+
+    uint64_t burst = 0, gap = 0;
+    bool seenInjection = false, seenMiss = false, burstAfterMiss = false;
+    int previous = -1;
+
+    for (uint64_t done = 0; done < makes; done += batchSize) {
+        size_t n = (size_t)std::min<uint64_t>(batchSize, makes - done);
+        ULONG state = stream.BurstState;
+        for (size_t i = 0; i < n; i++) {
+            batch[i] = {};
+            batch[i].MakeCode = kProbeCode;
+        }
+        KbCoreTransform(&profile, &stream, batch.data(), batch.data() + n);
+
+        if (burstModel) {
+            tally.from[state]++;
+            tally.switched[state] += (stream.BurstState != state);
+            tally.in[stream.BurstState]++;
+            tally.injectedIn[stream.BurstState] += (batch[0].MakeCode != kProbeCode);
+        }
+
+        for (size_t i = 0; i < n; i++) {
+            if (batch[i].MakeCode != kProbeCode) {
+                int r = index[batch[i].MakeCode & 0xFF];
+                tally.injected++;
+                tally.replacement[r]++;
+                if (previous >= 0) {
+                    tally.pairs[previous * ALLOWED_SCAN_CODE_COUNT + r]++;
+                }
+                previous = r;
+                if (seenInjection) {
+                    tally.gaps[std::min<uint64_t>(gap + 1, kMaxGap)]++;
+                }
+                seenInjection = true;
+                gap = 0;
+                if (burst++ == 0) {
+                    burstAfterMiss = seenMiss;
+                }
+            } else {
+                if (burst > 0 && burstAfterMiss) {
+                    tally.bursts[std::min<uint64_t>(burst, kMaxBurst)]++;
+                }
+                seenMiss = true;
+                burst = 0;
+                gap++;
+            }
+        }
+    }
+    tally.makes = makes;
+}
+
+struct Verdict {
+    std::string name;
+    std::string statistic;
+    double p;
+};
+
+// Two-sided binomial z-test of successes out of trials against chance q
+Verdict RateVerdict(const char* name, uint64_t successes, uint64_t trials, double q) {
+    char buffer[128];
+    double n = (double)trials;
+    double z = ((double)successes - n * q) / std::sqrt(n * q * (1 - q));
+    std::snprintf(buffer, sizeof(buffer), "rate %.7f  z %+.2f", successes / std::max(n, 1.0), z);
+    return { name, buffer, std::erfc(std::fabs(z) / std::sqrt(2.0)) };
+}
+
+// Gilbert-Elliott chain, transition then emission. A[o] = T diag(P(o | state))
+// for o = miss (0) or hit (1); row vectors are distributions over the state.
+struct BurstChain {
+    double emit[2][2];  // [o][state]
+    double A[2][2][2];  // [o][from][to]
+    double pi[2];
+
+    BurstChain(double good, double bad, double enter, double exit) {
+        const double T[2][2] = { { 1 - enter, enter }, { exit, 1 - exit } };
+        emit[1][KB_BURST_GOOD] = good;
+        emit[1][KB_BURST_BAD] = bad;
+        for (int j = 0; j < 2; j++) {
+            emit[0][j] = 1 - emit[1][j];
+        }
+        for (int o = 0; o < 2; o++) {
+            for (int i = 0; i < 2; i++) {
+                for (int j = 0; j < 2; j++) {
+                    A[o][i][j] = T[i][j] * emit[o][j];
+                }
+            }
+        }
+        pi[KB_BURST_GOOD] = exit / (enter + exit);
+        pi[KB_BURST_BAD] = enter / (enter + exit);
+    }
+
+    void Step(int o, double (&v)[2]) const {
+        double w0 = v[0] * A[o][0][0] + v[1] * A[o][1][0];
+        double w1 = v[0] * A[o][0][1] + v[1] * A[o][1][1];
+        v[0] = w0;
+        v[1] = w1;
+    }
+
+    // P(a run of outcome o has length k), k = 1 .. bins, the last bin being
+    // the tail. The run follows the other outcome in the stationary chain:
+    // u = pi diag(P(not o | state)) and P(k) = u A_o^k A_not-o 1 / u A_o 1.
+    std::vector<double> RunLengths(int o, size_t bins) const {
+        std::vector<double> p(bins);
+        double v[2] = { pi[0] * emit[1 - o][0], pi[1] * emit[1 - o][1] };
+        Step(o, v);
+        double start = v[0] + v[1];
+        for (size_t k = 1; k < bins; k++) {
+            double end[2] = { v[0], v[1] };
+            Step(1 - o, end);
+            p[k - 1] = (end[0] + end[1]) / start;
+            Step(o, v);
+        }
+        p[bins - 1] = (v[0] + v[1]) / start;
+        return p;
+    }
+};
+
+bool ParseArgs(int argc, char** argv, uint64_t& makes, ULONG& probability, unsigned& threads,
+               ULONG& seed, double& alpha, KB_CONFIG& burst) {
+    for (int i = 1; i + 1 < argc; i += 2) {
+        std::string arg = argv[i];
+        const char* value = argv[i + 1];
+        if (arg == "--makes") makes = std::strtoull(value, nullptr, 0);
+        else if (arg == "--probability") probability = (ULONG)std::strtoul(value, nullptr, 0);
+        else if (arg == "--threads") threads = (unsigned)std::strtoul(value, nullptr, 0);
+        else if (arg == "--seed") seed = (ULONG)std::strtoul(value, nullptr, 0);
+        else if (arg == "--alpha") alpha = std::atof(value);
+        else if (arg == "--burst") {
+            if (std::sscanf(value, "%u,%u,%u", &burst.BadProbability, &burst.EnterBad,
+                            &burst.ExitBad) != 3 ||
+                burst.BadProbability == 0 || burst.BadProbability >= 100 ||
+                burst.EnterBad == 0 || burst.EnterBad >= 10000 ||
+                burst.ExitBad == 0 || burst.ExitBad >= 10000) {
+                return false;
+            }
+        }
+        else return false;
+    }
+    return (argc % 2) == 1 && makes > 0 && probability > 0 && probability < 100 &&
+           alpha > 0 && alpha < 1;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    uint64_t makes = 2000000000ull;
+    ULONG probability = 10;
+    unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+    ULONG seed = 1;
+    double alpha = 1e-4;
+    KB_CONFIG config = { 0, KB_MODE_CHAOS };
+
+    if (!ParseArgs(argc, argv, makes, probability, threads, seed, alpha, config) || threads == 0) {
+        std::fprintf(stderr, "usage: %s [--makes N] [--probability 1-99] [--threads N] [--seed S] "
+                             "[--alpha A] [--burst BAD,ENTER,EXIT]\n", argv[0]);
+        return 2;
+    }
+
+    const bool burstModel = (config.EnterBad != 0);
+    // Chaos draws once per make; the burst model draws the state switch,
+    // then the injection
+    const uint64_t drawsPerMake = burstModel ? 2 : 1;
+    config.Probability = probability;
+    KB_PROFILE profile;
+    KbCoreCompileProfile(&profile, &config);
+
+    std::vector<Tally> tallies(threads);
+    std::vector<std::thread> workers;
+    auto start = std::chrono::steady_clock::now();
+    uint64_t offset = 0;
+    for (unsigned t = 0; t < threads; t++) {
+        uint64_t share = makes / threads + (t < makes % threads ? 1 : 0);
+        // Stream t starts where stream t - 1 ends, so the streams partition
+        // one run of the generator instead of overlapping at random
+        ULONG streamSeed = LcgJump(seed & (ULONG)kLcgMask, offset);
+        offset += share * drawsPerMake;
+        workers.emplace_back(Simulate, std::cref(profile), streamSeed, share, std::ref(tallies[t]));
+    }
+    for (auto& w : workers) {
+        w.join();
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    Tally total;
+    for (const Tally& t : tallies) {
+        total.Merge(t);
+    }
+
+    const double p = probability / 100.0;
+    const double k = ALLOWED_SCAN_CODE_COUNT;
+    std::vector<Verdict> verdicts;
+    char buffer[128];
+
+    if (burstModel) {
+        const double bad = config.BadProbability / 100.0;
+        const double enter = config.EnterBad / 10000.0;
+        const double exit = config.ExitBad / 10000.0;
+        const BurstChain chain(p, bad, enter, exit);
+
+        verdicts.push_back(RateVerdict("enter bad state", total.switched[KB_BURST_GOOD],
+            total.from[KB_BURST_GOOD], enter));
+        verdicts.push_back(RateVerdict("exit bad state", total.switched[KB_BURST_BAD],
+            total.from[KB_BURST_BAD], exit));
+        verdicts.push_back(RateVerdict("injection, good", total.injectedIn[KB_BURST_GOOD],
+            total.in[KB_BURST_GOOD], p));
+        verdicts.push_back(RateVerdict("injection, bad", total.injectedIn[KB_BURST_BAD],
+            total.in[KB_BURST_BAD], bad));
+
+        // Hit runs are the recorded bursts; a gap of g > 1 is a miss run of g - 1
+        for (int o = 1; o >= 0; o--) {
+            size_t bins = o ? kMaxBurst : kMaxGap - 1;
+            std::vector<double> model = chain.RunLengths(o, bins);
+            std::vector<double> observed(bins), expected(bins);
+            double runs = 0;
+            for (size_t r = 1; r <= bins; r++) {
+                observed[r - 1] = (double)(o ? total.bursts[r] : total.gaps[r + 1]);
+                runs += observed[r - 1];
+            }
+            for (size_t r = 0; r < bins; r++) {
+                expected[r] = runs * model[r];
+            }
+            stats::ChiSquare chi = stats::ChiSquareTest(observed, expected);
+            std::snprintf(buffer, sizeof(buffer), "chi2 %.1f  dof %d  runs %.0f", chi.statistic,
+                chi.dof, runs);
+            verdicts.push_back({ o ? "hit runs" : "miss runs", buffer, chi.p });
+        }
+    } else {
+        verdicts.push_back(RateVerdict("injection rate", total.injected, total.makes, p));
+    }
+
+    // Replacement distribution
+    {
+        std::vector<double> observed(total.replacement.begin(), total.replacement.end());
+        std::vector<double> expected(observed.size(), total.injected / k);
+        stats::ChiSquare chi = stats::ChiSquareTest(observed, expected);
+        std::snprintf(buffer, sizeof(buffer), "chi2 %.1f  dof %d", chi.statistic, chi.dof);
+        verdicts.push_back({ "replacement codes", buffer, chi.p });
+    }
+
+    // Consecutive replacement pairs
+    {
+        double pairs = 0;
+        for (uint64_t c : total.pairs) pairs += (double)c;
+        std::vector<double> observed(total.pairs.begin(), total.pairs.end());
+        std::vector<double> expected(observed.size(), pairs / (k * k));
+        stats::ChiSquare chi = stats::ChiSquareTest(observed, expected);
+        std::snprintf(buffer, sizeof(buffer), "chi2 %.1f  dof %d", chi.statistic, chi.dof);
+        verdicts.push_back({ "replacement pairs", buffer, chi.p });
+    }
+
+    // Burst lengths: P(B = b) = (1 - p) p^(b - 1); last bin is the tail
+    if (!burstModel) {
+        double bursts = 0;
+        for (uint64_t c : total.bursts) bursts += (double)c;
+        std::vector<double> observed, expected;
+        for (size_t b = 1; b <= kMaxBurst; b++) {
+            observed.push_back((double)total.bursts[b]);
+            expected.push_back(bursts * (b < kMaxBurst ? (1 - p) * std::pow(p, b - 1.0)
+                                                       : std::pow(p, b - 1.0)));
+        }
+        stats::ChiSquare chi = stats::ChiSquareTest(observed, expected);
+        std::snprintf(buffer, sizeof(buffer), "chi2 %.1f  dof %d  mean %.4f", chi.statistic, chi.dof,
+            total.injected / std::max(bursts, 1.0));
+        verdicts.push_back({ "burst lengths", buffer, chi.p });
+    }
+
+    // Gaps between injections: P(G <= g) = 1 - (1 - p)^g
+    if (!burstModel) {
+        stats::KolmogorovSmirnov ks = stats::KsTest(total.gaps, [&](size_t g) {
+            return g >= kMaxGap ? 1.0 : 1.0 - std::pow(1 - p, (double)g);
+        });
+        std::snprintf(buffer, sizeof(buffer), "D %.3g  n %.0f", ks.statistic, ks.n);
+        verdicts.push_back({ "gap lengths", buffer, ks.p });
+    }
+
+    std::printf("mode %u, probability %u%%, %llu makes on %u streams, %.2f s, %.1f Mmakes/s\n",
+        config.Mode, probability, (unsigned long long)total.makes, threads, seconds,
+        total.makes / seconds / 1e6);
+    if (burstModel) {
+        std::printf("burst: %u%% in the bad state, enter %u/10000, exit %u/10000\n",
+            config.BadProbability, config.EnterBad, config.ExitBad);
+    }
+    if (total.makes * drawsPerMake > kLcgPeriod) {
+        std::printf("note: %llu draws exceed the 2^31 LCG period, so the streams repeat each other\n",
+            (unsigned long long)(total.makes * drawsPerMake));
+    }
+
+    int rejected = 0;
+    for (const Verdict& v : verdicts) {
+        bool reject = v.p < alpha;
+        rejected += reject;
+        std::printf("  %-18s %-36s p %-10.3g %s\n", v.name.c_str(), v.statistic.c_str(), v.p,
+            reject ? "DEVIATES" : "ok");
+    }
+    return rejected ? 1 : 0;
+}
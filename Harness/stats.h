@@ -0,0 +1,144 @@
+// Goodness-of-fit helpers for the statistical validators: chi-square and
+// Kolmogorov-Smirnov p-values, computed in double precision.
+
+#ifndef KB_STATS_H
+#define KB_STATS_H
+
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+namespace stats {
+
+// Regularized upper incomplete gamma Q(a, x)
+inline double GammaQ(double a, double x) {
+    if (x <= 0) {
+        return 1.0;
+    }
+    double lnPrefix = -x + a * std::log(x) - std::lgamma(a);
+
+    if (x < a + 1) {
+        // Series for P(a, x)
+        double sum = 1.0 / a, term = sum;
+        for (int n = 1; n < 100000; n++) {
+            term *= x / (a + n);
+            sum += term;
+            if (std::fabs(term) < std::fabs(sum) * 1e-15) {
+                break;
+            }
+        }
+        return 1.0 - sum * std::exp(lnPrefix);
+    }
+
+    // Continued fraction for Q(a, x) (modified Lentz)
+    const double tiny = 1e-300;
+    double b = x + 1 - a, c = 1 / tiny, d = 1 / b, h = d;
+    for (int i = 1; i < 100000; i++) {
+        double an = -i * (i - a);
+        b += 2;
+        d = an * d + b;
+        if (std::fabs(d) < tiny) d = tiny;
+        c = b + an / c;
+        if (std::fabs(c) < tiny) c = tiny;
+        d = 1 / d;
+        double delta = d * c;
+        h *= delta;
+        if (std::fabs(delta - 1) < 1e-15) {
+            break;
+        }
+    }
+    return std::exp(lnPrefix) * h;
+}
+
+struct ChiSquare {
+    double statistic = 0;
+    int dof = 0;
+    double p = 1;
+};
+
+// Pearson chi-square of observed counts against expected counts. Bins with
+// an expected count below 5 are pooled with their neighbours first; a short
+// group left at the end joins the bin before it, so a thin tail cannot
+// contribute a bin of its own.
+inline ChiSquare ChiSquareTest(const std::vector<double>& observed,
+                               const std::vector<double>& expected, int constraints = 1) {
+    ChiSquare result;
+    std::vector<double> pooledO, pooledE;
+    double o = 0, e = 0;
+
+    for (size_t i = 0; i < observed.size(); i++) {
+        o += observed[i];
+        e += expected[i];
+        if (e >= 5) {
+            pooledO.push_back(o);
+            pooledE.push_back(e);
+            o = e = 0;
+        }
+    }
+    if (!pooledE.empty()) {
+        pooledO.back() += o;
+        pooledE.back() += e;
+    }
+    else if (e > 0) {
+        pooledO.push_back(o);
+        pooledE.push_back(e);
+    }
+
+    for (size_t i = 0; i < pooledE.size(); i++) {
+        result.statistic += (pooledO[i] - pooledE[i]) * (pooledO[i] - pooledE[i]) / pooledE[i];
+    }
+
+    result.dof = (int)pooledE.size() - constraints;
+    result.p = (result.dof > 0) ? GammaQ(result.dof / 2.0, result.statistic / 2.0) : 1.0;
+    return result;
+}
+
+// Asymptotic Kolmogorov distribution tail, P(K > lambda)
+inline double KolmogorovQ(double lambda) {
+    if (lambda < 0.2) {
+        return 1.0;
+    }
+    double sum = 0, sign = 1;
+    for (int j = 1; j <= 100; j++) {
+        double term = sign * std::exp(-2.0 * j * j * lambda * lambda);
+        sum += term;
+        if (std::fabs(term) < 1e-12) {
+            break;
+        }
+        sign = -sign;
+    }
+    return std::fmin(1.0, std::fmax(0.0, 2 * sum));
+}
+
+struct KolmogorovSmirnov {
+    double statistic = 0;
+    double n = 0;
+    double p = 1;
+};
+
+// One-sample KS test of a histogram (counts[k] = samples equal to k)
+// against a model CDF. For a discrete model this is conservative.
+template <typename Cdf>
+KolmogorovSmirnov KsTest(const std::vector<uint64_t>& counts, Cdf cdf) {
+    KolmogorovSmirnov result;
+    for (uint64_t c : counts) {
+        result.n += (double)c;
+    }
+    if (result.n == 0) {
+        return result;
+    }
+
+    double cumulative = 0;
+    for (size_t k = 0; k < counts.size(); k++) {
+        cumulative += (double)counts[k];
+        result.statistic = std::fmax(result.statistic, std::fabs(cumulative / result.n - cdf(k)));
+    }
+
+    double root = std::sqrt(result.n);
+    result.p = KolmogorovQ((root + 0.12 + 0.11 / root) * result.statistic);
+    return result;
+}
+
+}  // namespace stats
+
+#endif
@@ -0,0 +1,235 @@
+// Gilbert-Elliott injection model: profile selection and validation, the
+// specialized burst kernels against the generic one across batch cuts, the
+// degenerate chains, transposition under the model, and the config IOCTL
+// with both the full and the legacy two-field KB_CONFIG.
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+#include "check.h"
+#include "kmdf_shim.h"
+#include "packets.h"
+
+extern "C" PKB_PROFILE volatile g_Profile;
+
+namespace {
+
+const size_t kPackets = 4096;
+
+// Makes and breaks of letters and space
+Packets Input() {
+    return Keystrokes({ 0x1E, 0x30, 0x39, 0x10, 0x22 }, kPackets);
+}
+
+bool SameStream(const KB_STREAM& a, const KB_STREAM& b) {
+    return a.Seed == b.Seed && a.BurstState == b.BurstState &&
+           std::memcmp(&a.Histogram, &b.Histogram, sizeof(KB_HISTOGRAM)) == 0;
+}
+
+ULONG Sample(const KB_CONFIG& config) {
+    KB_PROFILE profile;
+    CHECK(KbCoreCompileProfile(&profile, &config));
+    return profile.Sample;
+}
+
+void TestCompile() {
+    KB_PROFILE profile;
+
+    CHECK(Sample({ 10, KB_MODE_CHAOS }) == KB_SAMPLE_COIN);
+    CHECK(Sample({ 10, KB_MODE_CHAOS, 90, 0, 100 }) == KB_SAMPLE_COIN);   // never enters
+    CHECK(Sample({ 10, KB_MODE_CHAOS, 90, 5, 100 }) == KB_SAMPLE_BURST);
+    CHECK(Sample({ 0, KB_MODE_CHAOS, 90, 5, 0 }) == KB_SAMPLE_BURST);
+    CHECK(Sample({ 100, KB_MODE_CHAOS, 0, 5, 100 }) == KB_SAMPLE_BURST);
+    CHECK(Sample({ 0, KB_MODE_CHAOS, 0, 5, 100 }) == KB_SAMPLE_NEVER);
+
+    const KB_CONFIG invalid[] = {
+        { 101, KB_MODE_CHAOS },
+        { 10, KB_MODE_CHAOS, 101, 5, 100 },
+        { 10, KB_MODE_CHAOS, 50, 10001, 100 },
+        { 10, KB_MODE_CHAOS, 50, 5, 10001 },
+    };
+    for (const KB_CONFIG& config : invalid) {
+        CHECK(!KbCoreCompileProfile(&profile, &config));
+    }
+
+    KB_CONFIG config = { 100, KB_MODE_DROP, 50, 10000, 1 };
+    CHECK(KbCoreCompileProfile(&profile, &config));
+    CHECK(profile.InjectThreshold[KB_BURST_GOOD] == 0x80000000u);
+    CHECK(profile.InjectThreshold[KB_BURST_BAD] == 0x40000000u);
+    CHECK(profile.SwitchThreshold[KB_BURST_GOOD] == 0x80000000u);
+    CHECK(profile.SwitchThreshold[KB_BURST_BAD] == 0x80000000u / 10000);
+}
+
+void TestKernels() {
+    const Packets input = Input();
+    for (ULONG mode = 0; mode < KB_MODE_COUNT; mode++) {
+        if (mode == KB_MODE_TRANSPOSE) {
+            continue;
+        }
+        KB_CONFIG config = { 5, mode, 60, 50, 500 };
+        KB_PROFILE profile;
+        CHECK(KbCoreCompileProfile(&profile, &config));
+
+        KB_STREAM generic, whole;
+        KbCoreInitStream(&generic, 7);
+        KbCoreInitStream(&whole, 7);
+        Packets a = input, b = input;
+        KbCoreTransformGeneric(&profile, &generic, a.data(), a.data() + a.size());
+        KbCoreTransform(&profile, &whole, b.data(), b.data() + b.size());
+        // The pass-through kernel leaves the seed alone; the generic loop does not
+        CHECK(Same(a, b));
+        CHECK(std::memcmp(&generic.Histogram, &whole.Histogram, sizeof(KB_HISTOGRAM)) == 0);
+        CHECK(mode == KB_MODE_NORMAL || SameStream(generic, whole));
+
+        // The state carries over between batches
+        for (size_t cut : { 1, 3, 64, 1000 }) {
+            KB_STREAM stream;
+            KbCoreInitStream(&stream, 7);
+            Packets c = input;
+            for (size_t i = 0; i < c.size(); i += cut) {
+                size_t end = std::min(c.size(), i + cut);
+                KbCoreTransform(&profile, &stream, c.data() + i, c.data() + end);
+            }
+            CHECK(Same(b, c));
+            CHECK(SameStream(whole, stream));
+        }
+    }
+
+    // Both states visited and the bad state injects more
+    KB_CONFIG config = { 5, KB_MODE_DROP, 60, 50, 500 };
+    KB_PROFILE profile;
+    KbCoreCompileProfile(&profile, &config);
+    KB_STREAM stream;
+    KbCoreInitStream(&stream, 7);
+    ULONG makes[2] = {}, dropped[2] = {};
+    for (int round = 0; round < 50; round++) {
+        for (const KEYBOARD_INPUT_DATA& packet : input) {
+            KEYBOARD_INPUT_DATA p = packet;
+            KbCoreTransform(&profile, &stream, &p, &p + 1);
+            if (packet.Flags == KEY_MAKE) {
+                makes[stream.BurstState]++;
+                dropped[stream.BurstState] += (p.Flags != KEY_MAKE);
+            }
+        }
+    }
+    CHECK(makes[KB_BURST_GOOD] > 0 && makes[KB_BURST_BAD] > 0);
+    CHECK(dropped[KB_BURST_BAD] * 5 > makes[KB_BURST_BAD] * 2);
+    CHECK(dropped[KB_BURST_GOOD] * 10 < makes[KB_BURST_GOOD]);
+}
+
+void TestDegenerate() {
+    const Packets input = Input();
+    KB_PROFILE profile;
+    KB_STREAM stream;
+
+    // Straight into a bad state that injects always and is never left
+    KB_CONFIG absorbing = { 0, KB_MODE_DROP, 100, 10000, 0 };
+    KbCoreCompileProfile(&profile, &absorbing);
+    KbCoreInitStream(&stream, 3);
+    Packets work = input;
+    KbCoreTransform(&profile, &stream, work.data(), work.data() + work.size());
+    CHECK(stream.BurstState == KB_BURST_BAD);
+    for (const KEYBOARD_INPUT_DATA& p : work) {
+        CHECK(p.Flags == KEY_BREAK);
+    }
+
+    // Flips state on every make; only the bad ones inject
+    KB_CONFIG alternating = { 0, KB_MODE_DROP, 100, 10000, 10000 };
+    KbCoreCompileProfile(&profile, &alternating);
+    KbCoreInitStream(&stream, 3);
+    work = input;
+    KbCoreTransform(&profile, &stream, work.data(), work.data() + work.size());
+    for (size_t i = 0; i < work.size(); i += 2) {
+        CHECK(work[i].Flags == (((i / 2) % 2) ? KEY_MAKE : KEY_BREAK));
+    }
+}
+
+void TestTranspose() {
+    const Packets input = Input();
+    KB_PROFILE burst, always;
+    KB_CONFIG absorbing = { 0, KB_MODE_TRANSPOSE, 100, 10000, 0 };
+    KB_CONFIG hundred = { 100, KB_MODE_TRANSPOSE };
+    KbCoreCompileProfile(&burst, &absorbing);
+    KbCoreCompileProfile(&always, &hundred);
+
+    // An absorbing bad state at 100% transposes exactly like Probability 100
+    KB_STREAM a, b;
+    KbCoreInitStream(&a, 5);
+    KbCoreInitStream(&b, 5);
+    Packets outA, outB;
+    Packets work = input;
+    KbCoreTransformStream(&burst, &a, work.data(), work.data() + work.size(), Collect, &outA);
+    KbCoreFlushStream(&a, Collect, &outA);
+    work = input;
+    KbCoreTransformStream(&always, &b, work.data(), work.data() + work.size(), Collect, &outB);
+    KbCoreFlushStream(&b, Collect, &outB);
+    CHECK(Same(outA, outB));
+    CHECK(std::memcmp(&a.Histogram, &b.Histogram, sizeof(KB_HISTOGRAM)) == 0);
+
+    // Bursty transposition is cut-independent and keeps every packet
+    KB_CONFIG config = { 10, KB_MODE_TRANSPOSE, 80, 100, 1000 };
+    KbCoreCompileProfile(&burst, &config);
+    Packets whole, pieces;
+    KbCoreInitStream(&a, 5);
+    KbCoreInitStream(&b, 5);
+    work = input;
+    KbCoreTransformStream(&burst, &a, work.data(), work.data() + work.size(), Collect, &whole);
+    KbCoreFlushStream(&a, Collect, &whole);
+    work = input;
+    for (size_t i = 0; i < work.size(); i += 3) {
+        size_t end = std::min(work.size(), i + 3);
+        KbCoreTransformStream(&burst, &b, work.data() + i, work.data() + end, Collect, &pieces);
+    }
+    KbCoreFlushStream(&b, Collect, &pieces);
+    CHECK(Same(whole, pieces));
+    CHECK(whole.size() == input.size());
+    CHECK(a.Histogram.Counts[KB_ACTION_TRANSPOSED][0x1E] != 0);
+}
+
+void TestIoctl() {
+    NTSTATUS status;
+    WDFDEVICE device = kmdf::StartDevice(&status);
+    CHECK(device != nullptr);
+
+    KB_CONFIG config = { 2, KB_MODE_DROP, 70, 25, 400 };
+    CHECK(NT_SUCCESS(kmdf::SetConfig(device, config)));
+    CHECK(g_Profile->Sample == KB_SAMPLE_BURST);
+    CHECK(std::memcmp(&g_Profile->Config, &config, sizeof(config)) == 0);
+
+    // Persisted and restored with the burst fields
+    kmdf::Request persist;
+    persist.ioctl = IOCTL_KBFILTR_PERSIST_CONFIG;
+    kmdf::Dispatch(kmdf::RawPdoQueue(device), persist);
+    CHECK(NT_SUCCESS(persist.status));
+    kmdf::Reset();
+    CHECK(NT_SUCCESS(kmdf::LoadDriver()));
+    CHECK(std::memcmp(&g_Profile->Config, &config, sizeof(config)) == 0);
+    CHECK(g_Profile->Sample == KB_SAMPLE_BURST);
+    kmdf::ClearParameters();
+    device = kmdf::AddDevice(&status);
+    CHECK(device != nullptr);
+
+    // An older client's two fields turn the model off again
+    const ULONG legacy[2] = { 30, KB_MODE_CHAOS };
+    CHECK(NT_SUCCESS(kmdf::SetConfig(device, legacy, sizeof(legacy))));
+    CHECK(g_Profile->Sample == KB_SAMPLE_COIN);
+    CHECK(g_Profile->Config.Probability == 30 && g_Profile->Config.Mode == KB_MODE_CHAOS);
+    CHECK(g_Profile->Config.BadProbability == 0 && g_Profile->Config.EnterBad == 0 &&
+          g_Profile->Config.ExitBad == 0);
+
+    CHECK(kmdf::SetConfig(device, legacy, sizeof(ULONG)) == STATUS_BUFFER_TOO_SMALL);
+    CHECK(kmdf::SetConfig(device, { 2, KB_MODE_DROP, 70, 25, 10001 }) == STATUS_INVALID_PARAMETER);
+    CHECK(g_Profile->Sample == KB_SAMPLE_COIN);
+}
+
+}  // namespace
+
+int main() {
+    TestCompile();
+    TestKernels();
+    TestDegenerate();
+    TestTranspose();
+    TestIoctl();
+    return CheckResult("burst_test");
+}
@@ -0,0 +1,31 @@
+// Minimal assertion helpers for the harness tests: a failed CHECK reports
+// the expression and keeps going; main returns CheckResult().
+
+#ifndef HARNESS_CHECK_H
+#define HARNESS_CHECK_H
+
+#include <cstdio>
+
+inline int& CheckFailures() {
+    static int failures = 0;
+    return failures;
+}
+
+#define CHECK(expr)                                                             \
+    do {                                                                        \
+        if (!(expr)) {                                                          \
+            std::fprintf(stderr, "%s:%d: CHECK failed: %s\n", __FILE__, __LINE__, #expr); \
+            CheckFailures()++;                                                  \
+        }                                                                       \
+    } while (0)
+
+inline int CheckResult(const char* name) {
+    if (CheckFailures() != 0) {
+        std::fprintf(stderr, "%s: %d check(s) failed\n", name, CheckFailures());
+        return 1;
+    }
+    std::printf("%s: ok\n", name);
+    return 0;
+}
+
+#endif
@@ -0,0 +1,186 @@
+// Persisted config: blob validation in the portable core, and the driver's
+// boot-time load and IOCTL_KBFILTR_PERSIST_CONFIG through the KMDF shim.
+
+#include <cstring>
+#include <vector>
+
+#include "check.h"
+#include "kmdf_shim.h"
+
+extern "C" PKB_PROFILE volatile g_Profile;
+
+namespace {
+
+const ULONG kRegDword = 4;
+
+using Blob = std::vector<unsigned char>;
+
+Blob Save(const KB_CONFIG& config) {
+    Blob blob(KB_CONFIG_BLOB_MAX_SIZE);
+    blob.resize(KbCoreSaveConfigBlob(&config, blob.data(), (ULONG)blob.size()));
+    return blob;
+}
+
+bool Load(const Blob& blob, KB_CONFIG* config) {
+    return KbCoreLoadConfigBlob(blob.data(), (ULONG)blob.size(), config) != FALSE;
+}
+
+bool SameConfig(const KB_CONFIG& a, const KB_CONFIG& b) {
+    return std::memcmp(&a, &b, sizeof(KB_CONFIG)) == 0;
+}
+
+// Header followed by payload, with the checksum the core would compute
+Blob Assemble(const Blob& payload, ULONG configSize) {
+    KB_CONFIG_BLOB_HEADER header = { KB_CONFIG_BLOB_SIGNATURE, KB_CONFIG_BLOB_VERSION, configSize, 0 };
+    ULONG hash = 2166136261u;
+    for (ULONG i = 0; i < configSize && i < payload.size(); i++) {
+        hash = (hash ^ payload[i]) * 16777619u;
+    }
+    header.Checksum = hash;
+    Blob blob((unsigned char*)&header, (unsigned char*)&header + sizeof(header));
+    blob.insert(blob.end(), payload.begin(), payload.end());
+    return blob;
+}
+
+void TestRoundTrip() {
+    for (ULONG mode = 0; mode < KB_MODE_COUNT; mode++) {
+        for (ULONG probability : { 0u, 1u, 50u, 100u }) {
+            KB_CONFIG config = {};
+            config.Probability = probability;
+            config.Mode = mode;
+            KB_CONFIG loaded = {};
+            CHECK(Load(Save(config), &loaded));
+            CHECK(SameConfig(config, loaded));
+        }
+    }
+    KB_CONFIG config = { 10, KB_MODE_CHAOS };
+    unsigned char small[sizeof(KB_CONFIG_BLOB_HEADER) + sizeof(KB_CONFIG) - 1];
+    CHECK(KbCoreSaveConfigBlob(&config, small, sizeof(small)) == 0);
+}
+
+void TestRejects() {
+    KB_CONFIG config = { 40, KB_MODE_DROP };
+    const Blob good = Save(config);
+    const KB_CONFIG sentinel = { 77, 77 };
+    KB_CONFIG out = sentinel;
+
+    CHECK(!KbCoreLoadConfigBlob(nullptr, 0, &out));
+    for (size_t length = 0; length < good.size(); length++) {
+        CHECK(!KbCoreLoadConfigBlob(good.data(), (ULONG)length, &out));
+    }
+
+    // Every single-bit corruption of header or payload is caught
+    for (size_t bit = 0; bit < good.size() * 8; bit++) {
+        Blob bad = good;
+        bad[bit / 8] ^= (unsigned char)(1u << (bit % 8));
+        CHECK(!Load(bad, &out));
+    }
+
+    // Well-formed blobs carrying a config the engine would refuse
+    KB_CONFIG invalid = { 101, KB_MODE_CHAOS };
+    Blob payload((unsigned char*)&invalid, (unsigned char*)&invalid + sizeof(invalid));
+    CHECK(!Load(Assemble(payload, sizeof(invalid)), &out));
+
+    // Too short to hold Probability and Mode
+    CHECK(!Load(Assemble(Blob(4, 0), 4), &out));
+
+    CHECK(SameConfig(out, sentinel));
+}
+
+void TestCompatibility() {
+    KB_CONFIG config = { 25, KB_MODE_DROP_SPACE };
+    Blob payload((unsigned char*)&config, (unsigned char*)&config + sizeof(config));
+    KB_CONFIG out = {};
+
+    // Written by a newer driver: unknown trailing fields are ignored
+    Blob longer = payload;
+    longer.insert(longer.end(), { 1, 2, 3, 4, 5, 6, 7, 8 });
+    CHECK(Load(Assemble(longer, (ULONG)longer.size()), &out));
+    CHECK(SameConfig(out, config));
+
+    // Trailing bytes past ConfigSize are not part of the config
+    Blob padded = Assemble(payload, (ULONG)payload.size());
+    padded.insert(padded.end(), 16, 0xCC);
+    CHECK(Load(padded, &out));
+    CHECK(SameConfig(out, config));
+
+    // Written by an older driver: only the legacy fields are present
+    Blob legacy(payload.begin(), payload.begin() + KB_CONFIG_BLOB_MIN_CONFIG);
+    KB_CONFIG expected = {};
+    std::memcpy(&expected, legacy.data(), legacy.size());
+    CHECK(Load(Assemble(legacy, (ULONG)legacy.size()), &out));
+    CHECK(SameConfig(out, expected));
+}
+
+// Loads the driver as on boot and returns the active config
+KB_CONFIG Boot() {
+    kmdf::Reset();
+    CHECK(NT_SUCCESS(kmdf::LoadDriver()));
+    CHECK(kmdf::OpenKeys() == 0);
+    return g_Profile->Config;
+}
+
+void TestBootLoad() {
+    const KB_CONFIG defaults = { 10, KB_MODE_CHAOS };
+    const std::wstring name = KBFILTR_CONFIG_VALUE_NAME;
+
+    kmdf::ClearParameters();
+    CHECK(SameConfig(Boot(), defaults));
+
+    KB_CONFIG persisted = { 60, KB_MODE_DROP };
+    kmdf::SetParameter(name, REG_BINARY, Save(persisted));
+    CHECK(SameConfig(Boot(), persisted));
+    KB_PROFILE expected;
+    KbCoreCompileProfile(&expected, &persisted);
+    CHECK(g_Profile->Kernel == expected.Kernel);
+
+    Blob corrupt = Save(persisted);
+    corrupt.back() ^= 1;
+    kmdf::SetParameter(name, REG_BINARY, corrupt);
+    CHECK(SameConfig(Boot(), defaults));
+
+    kmdf::SetParameter(name, kRegDword, Save(persisted));
+    CHECK(SameConfig(Boot(), defaults));
+
+    Blob oversized = Save(persisted);
+    oversized.resize(KB_CONFIG_BLOB_MAX_SIZE + 1);
+    kmdf::SetParameter(name, REG_BINARY, oversized);
+    CHECK(SameConfig(Boot(), defaults));
+
+    kmdf::ClearParameters();
+}
+
+void TestPersistIoctl() {
+    WDFDEVICE device = kmdf::StartDevice();
+    CHECK(device != nullptr);
+    // PERSIST writes the registry, which needs PASSIVE_LEVEL
+    CHECK(kmdf::QueueExecutionLevel(kmdf::RawPdoQueue(device)) == WdfExecutionLevelPassive);
+
+    KB_CONFIG config = { 100, KB_MODE_DROP_SPACE };
+    CHECK(NT_SUCCESS(kmdf::SetConfig(device, config)));
+
+    kmdf::Request persist;
+    persist.ioctl = IOCTL_KBFILTR_PERSIST_CONFIG;
+    kmdf::Dispatch(kmdf::RawPdoQueue(device), persist);
+    CHECK(NT_SUCCESS(persist.status));
+    CHECK(kmdf::OpenKeys() == 0);
+
+    ULONG type = 0;
+    Blob stored;
+    CHECK(kmdf::GetParameter(KBFILTR_CONFIG_VALUE_NAME, &type, &stored));
+    CHECK(type == REG_BINARY);
+
+    CHECK(SameConfig(Boot(), config));
+    kmdf::ClearParameters();
+}
+
+}  // namespace
+
+int main() {
+    TestRoundTrip();
+    TestRejects();
+    TestCompatibility();
+    TestBootLoad();
+    TestPersistIoctl();
+    return CheckResult("config_blob_test");
+}
@@ -0,0 +1,173 @@
+// Injection histogram: every changed packet is counted once under the right
+// action and code, nothing else is, the specialized kernels agree with the
+// generic one, and IOCTL_KBFILTR_GET_HISTOGRAM returns the device's counts.
+
+#include <cstring>
+#include <vector>
+
+#include "check.h"
+#include "kmdf_shim.h"
+#include "packets.h"
+
+namespace {
+
+const size_t kPackets = 4096;
+
+// Makes and breaks of letters, space and an E0 key
+Packets Input() {
+    Packets input = Keystrokes({ 0x1E, 0x30, 0x39, 0x10, 0x4D, 0x39, 0x22 }, kPackets);
+    for (KEYBOARD_INPUT_DATA& p : input) {
+        if (p.MakeCode == 0x4D) {
+            p.Flags |= KEY_E0;
+        }
+    }
+    return input;
+}
+
+ULONG Total(const KB_HISTOGRAM& histogram, ULONG action) {
+    ULONG total = 0;
+    for (ULONG count : histogram.Counts[action]) {
+        total += count;
+    }
+    return total;
+}
+
+VOID Discard(PVOID, PKEYBOARD_INPUT_DATA, PKEYBOARD_INPUT_DATA) {
+}
+
+// Recounts what the kernel did from its input and output
+void CheckAgainstOutput(ULONG mode, const Packets& input, const Packets& output,
+                        const KB_HISTOGRAM& histogram) {
+    KB_HISTOGRAM expected = {};
+    for (size_t i = 0; i < input.size(); i++) {
+        const KEYBOARD_INPUT_DATA& in = input[i];
+        const KEYBOARD_INPUT_DATA& out = output[i];
+        if (mode == KB_MODE_CHAOS && in.Flags == KEY_MAKE && in.MakeCode != out.MakeCode) {
+            expected.Counts[KB_ACTION_SWAPPED_OUT][in.MakeCode]++;
+            expected.Counts[KB_ACTION_SWAPPED_IN][out.MakeCode]++;
+        }
+        if (mode == KB_MODE_DROP && in.Flags != out.Flags) {
+            expected.Counts[KB_ACTION_DROPPED][in.MakeCode]++;
+        }
+        if (mode == KB_MODE_DROP_SPACE && in.MakeCode != out.MakeCode) {
+            expected.Counts[KB_ACTION_DROPPED][in.MakeCode]++;
+        }
+    }
+
+    // A chaos replacement may pick the code it replaces; it is still counted
+    if (mode == KB_MODE_CHAOS) {
+        CHECK(Total(histogram, KB_ACTION_SWAPPED_OUT) == Total(histogram, KB_ACTION_SWAPPED_IN));
+        CHECK(Total(histogram, KB_ACTION_SWAPPED_OUT) >= Total(expected, KB_ACTION_SWAPPED_OUT));
+        for (ULONG action = 0; action < KB_ACTION_COUNT; action++) {
+            for (ULONG code = 0; code < KB_HISTOGRAM_CODES; code++) {
+                CHECK(histogram.Counts[action][code] >= expected.Counts[action][code]);
+            }
+        }
+    } else {
+        CHECK(std::memcmp(&histogram, &expected, sizeof(expected)) == 0);
+    }
+}
+
+void TestKernels() {
+    const Packets input = Input();
+    for (ULONG mode = 0; mode < KB_MODE_COUNT; mode++) {
+        if (mode == KB_MODE_TRANSPOSE) {
+            continue;
+        }
+        for (ULONG probability : { 0u, 1u, 50u, 100u }) {
+            KB_CONFIG config = { probability, mode };
+            KB_PROFILE profile;
+            CHECK(KbCoreCompileProfile(&profile, &config));
+
+            KB_STREAM generic, specialized;
+            KbCoreInitStream(&generic, 99);
+            KbCoreInitStream(&specialized, 99);
+            Packets a = input, b = input;
+            KbCoreTransformGeneric(&profile, &generic, a.data(), a.data() + a.size());
+            KbCoreTransform(&profile, &specialized, b.data(), b.data() + b.size());
+
+            CHECK(std::memcmp(&generic.Histogram, &specialized.Histogram, sizeof(KB_HISTOGRAM)) == 0);
+            CheckAgainstOutput(mode, input, b, specialized.Histogram);
+
+            if (probability == 0 || mode == KB_MODE_NORMAL) {
+                KB_HISTOGRAM zero = {};
+                CHECK(std::memcmp(&specialized.Histogram, &zero, sizeof(zero)) == 0);
+            }
+        }
+    }
+
+    // Exactly the space makes: 2 of every 7 makes, 585 of 2048
+    KB_CONFIG config = { 100, KB_MODE_DROP_SPACE };
+    KB_PROFILE profile;
+    KbCoreCompileProfile(&profile, &config);
+    KB_STREAM stream;
+    KbCoreInitStream(&stream, 1);
+    Packets work = input;
+    KbCoreTransform(&profile, &stream, work.data(), work.data() + work.size());
+    CHECK(Total(stream.Histogram, KB_ACTION_DROPPED) == stream.Histogram.Counts[KB_ACTION_DROPPED][0x39]);
+    CHECK(stream.Histogram.Counts[KB_ACTION_DROPPED][0x39] == 585);
+}
+
+void TestTranspose() {
+    KB_CONFIG config = { 100, KB_MODE_TRANSPOSE };
+    KB_PROFILE profile;
+    KbCoreCompileProfile(&profile, &config);
+    KB_STREAM stream;
+    KbCoreInitStream(&stream, 1);
+
+    // a b c d: a and c are held and moved after b and d
+    Packets input;
+    for (USHORT code : { 0x1E, 0x30, 0x2E, 0x20 }) {
+        KEYBOARD_INPUT_DATA p = {};
+        p.MakeCode = code;
+        input.push_back(p);
+        p.Flags = KEY_BREAK;
+        input.push_back(p);
+    }
+    KbCoreTransformStream(&profile, &stream, input.data(), input.data() + input.size(), Discard, nullptr);
+    CHECK(Total(stream.Histogram, KB_ACTION_TRANSPOSED) == 2);
+    CHECK(stream.Histogram.Counts[KB_ACTION_TRANSPOSED][0x1E] == 1);
+    CHECK(stream.Histogram.Counts[KB_ACTION_TRANSPOSED][0x2E] == 1);
+
+    // Released by a flush, not transposed
+    KbCoreTransformStream(&profile, &stream, input.data(), input.data() + 1, Discard, nullptr);
+    KbCoreFlushStream(&stream, Discard, nullptr);
+    CHECK(Total(stream.Histogram, KB_ACTION_TRANSPOSED) == 2);
+}
+
+void TestIoctl() {
+    WDFDEVICE device = kmdf::StartDevice();
+    CHECK(device != nullptr);
+    CONNECT_DATA connect;
+    CHECK(kmdf::Connect(device, &connect));
+    CHECK(NT_SUCCESS(kmdf::SetConfig(device, { 100, KB_MODE_DROP })));
+
+    Packets input = Input();
+    kmdf::Service(connect, input.data(), input.data() + input.size());
+
+    kmdf::Request get;
+    get.ioctl = IOCTL_KBFILTR_GET_HISTOGRAM;
+    get.output.resize(sizeof(KB_HISTOGRAM) - 1);
+    kmdf::Dispatch(kmdf::RawPdoQueue(device), get);
+    CHECK(get.status == STATUS_BUFFER_TOO_SMALL);
+
+    get.output.assign(sizeof(KB_HISTOGRAM), 0xFF);
+    kmdf::Dispatch(kmdf::RawPdoQueue(device), get);
+    CHECK(NT_SUCCESS(get.status));
+    CHECK(get.information == sizeof(KB_HISTOGRAM));
+    KB_HISTOGRAM histogram;
+    std::memcpy(&histogram, get.output.data(), sizeof(histogram));
+    // Every make but the E0 ones (1 of every 7)
+    CHECK(Total(histogram, KB_ACTION_DROPPED) == kPackets / 2 - kPackets / 14);
+    CHECK(histogram.Counts[KB_ACTION_DROPPED][0x1E] == 293);
+    CHECK(Total(histogram, KB_ACTION_SWAPPED_OUT) == 0);
+}
+
+}  // namespace
+
+int main() {
+    TestKernels();
+    TestTranspose();
+    TestIoctl();
+    return CheckResult("histogram_test");
+}
@@ -0,0 +1,41 @@
+// Keyboard packet helpers for the harness tests: building input, collecting
+// what the engine emits and comparing the two.
+
+#ifndef HARNESS_PACKETS_H
+#define HARNESS_PACKETS_H
+
+#include <cstring>
+#include <initializer_list>
+#include <vector>
+
+#include "kbcore.h"
+
+using Packets = std::vector<KEYBOARD_INPUT_DATA>;
+
+inline KEYBOARD_INPUT_DATA Packet(USHORT makeCode, USHORT flags) {
+    KEYBOARD_INPUT_DATA p = {};
+    p.MakeCode = makeCode;
+    p.Flags = flags;
+    return p;
+}
+
+// count packets typing the codes in turn, a make then a break each
+inline Packets Keystrokes(std::initializer_list<USHORT> codes, size_t count) {
+    Packets input(count);
+    for (size_t i = 0; i < count; i++) {
+        input[i] = Packet(codes.begin()[(i / 2) % codes.size()], (i % 2) ? KEY_BREAK : KEY_MAKE);
+    }
+    return input;
+}
+
+inline bool Same(const Packets& a, const Packets& b) {
+    return a.size() == b.size() &&
+           (a.empty() || std::memcmp(a.data(), b.data(), a.size() * sizeof(a[0])) == 0);
+}
+
+// KB_EMIT_ROUTINE appending to the Packets passed as Context
+inline VOID Collect(PVOID Context, PKEYBOARD_INPUT_DATA Start, PKEYBOARD_INPUT_DATA End) {
+    static_cast<Packets*>(Context)->insert(static_cast<Packets*>(Context)->end(), Start, End);
+}
+
+#endif
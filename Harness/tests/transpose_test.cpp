@@ -0,0 +1,295 @@
+// KB_MODE_TRANSPOSE: the holdback slot and its lookahead across callbacks.
+//
+// Every packet sequence up to kMaxLength over a small alphabet (typed keys,
+// their breaks, a non-typing key and an E0 key) is cut into batches in
+// every possible way; the output must not depend on where the cuts fall.
+// It must also keep every packet, and keep each key's own packets in
+// order, so a make is never separated from its break. The driver's
+// holdback timer, and what it reports when the class driver falls short,
+// are checked through the KMDF shim.
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include "check.h"
+#include "kmdf_shim.h"
+#include "packets.h"
+
+namespace {
+
+const size_t kMaxLength = 6;
+
+const USHORT kA = 0x1E, kB = 0x30, kEnter = 0x1C, kRight = 0x4D;
+
+const KEYBOARD_INPUT_DATA kAlphabet[] = {
+    Packet(kA, KEY_MAKE), Packet(kA, KEY_BREAK),
+    Packet(kB, KEY_MAKE), Packet(kB, KEY_BREAK),
+    Packet(kEnter, KEY_MAKE),
+    Packet(kRight, KEY_MAKE | KEY_E0),
+};
+const size_t kSymbols = sizeof(kAlphabet) / sizeof(kAlphabet[0]);
+
+KB_PROFILE Profile(ULONG probability, ULONG mode = KB_MODE_TRANSPOSE) {
+    KB_CONFIG config = { probability, mode };
+    KB_PROFILE profile;
+    CHECK(KbCoreCompileProfile(&profile, &config));
+    return profile;
+}
+
+// Feeds input in batches ending at the given cuts, then flushes
+Packets Run(const KB_PROFILE& profile, ULONG seed, Packets input, const std::vector<size_t>& cuts,
+            bool flushAtCuts = false) {
+    KB_STREAM stream;
+    KbCoreInitStream(&stream, seed);
+    Packets output;
+    size_t begin = 0;
+    for (size_t end : cuts) {
+        KbCoreTransformStream(&profile, &stream, input.data() + begin, input.data() + end,
+            Collect, &output);
+        if (flushAtCuts) {
+            KbCoreFlushStream(&stream, Collect, &output);
+        }
+        begin = end;
+    }
+    KbCoreTransformStream(&profile, &stream, input.data() + begin, input.data() + input.size(),
+        Collect, &output);
+    KbCoreFlushStream(&stream, Collect, &output);
+    CHECK(stream.HeldCount == 0);
+    return output;
+}
+
+bool SameKey(const KEYBOARD_INPUT_DATA& p, const KEYBOARD_INPUT_DATA& key) {
+    return p.MakeCode == key.MakeCode && (p.Flags & KEY_E0) == (key.Flags & KEY_E0);
+}
+
+// Each key's own packets (make code plus E0) appear in the same order
+bool SameKeyOrder(const KEYBOARD_INPUT_DATA* a, const KEYBOARD_INPUT_DATA* b, size_t count) {
+    for (const KEYBOARD_INPUT_DATA& key : kAlphabet) {
+        size_t i = 0, j = 0;
+        for (;;) {
+            while (i < count && !SameKey(a[i], key)) i++;
+            while (j < count && !SameKey(b[j], key)) j++;
+            if (i == count || j == count) {
+                if (i != j) return false;
+                break;
+            }
+            if (a[i].Flags != b[j].Flags) return false;
+            i++;
+            j++;
+        }
+    }
+    return true;
+}
+
+Packets Sequence(std::initializer_list<KEYBOARD_INPUT_DATA> packets) {
+    return Packets(packets);
+}
+
+void TestExamples() {
+    const KB_PROFILE always = Profile(100);
+    const KEYBOARD_INPUT_DATA aD = Packet(kA, KEY_MAKE), aU = Packet(kA, KEY_BREAK);
+    const KEYBOARD_INPUT_DATA bD = Packet(kB, KEY_MAKE), bU = Packet(kB, KEY_BREAK);
+    const KEYBOARD_INPUT_DATA cD = Packet(0x2E, KEY_MAKE), cU = Packet(0x2E, KEY_BREAK);
+    const KEYBOARD_INPUT_DATA dD = Packet(0x20, KEY_MAKE), dU = Packet(0x20, KEY_BREAK);
+    const KEYBOARD_INPUT_DATA enter = Packet(kEnter, KEY_MAKE);
+
+    CHECK(Same(Run(always, 1, Sequence({ aD, aU, bD, bU }), {}), Sequence({ bD, aD, aU, bU })));
+    // Rollover: b goes down before a comes up
+    CHECK(Same(Run(always, 1, Sequence({ aD, bD, aU, bU }), {}), Sequence({ bD, aD, aU, bU })));
+    CHECK(Same(Run(always, 1, Sequence({ aD, aU, bD, bU, cD, cU, dD, dU }), {}),
+               Sequence({ bD, aD, aU, bU, dD, cD, cU, dU })));
+    // Only typed keys trade places
+    CHECK(Same(Run(always, 1, Sequence({ aD, aU, enter }), {}), Sequence({ aD, aU, enter })));
+    // Probability 0 holds nothing
+    CHECK(Same(Run(Profile(0), 1, Sequence({ aD, aU, bD, bU }), {}), Sequence({ aD, aU, bD, bU })));
+}
+
+// Every sequence of the given length, every way of cutting it
+void TestBatchBoundaries(const KB_PROFILE& profile, ULONG seed, size_t length) {
+    std::vector<size_t> digits(length, 0);
+    Packets input(length);
+
+    for (;;) {
+        for (size_t i = 0; i < length; i++) {
+            input[i] = kAlphabet[digits[i]];
+        }
+
+        const Packets whole = Run(profile, seed, input, {});
+        CHECK(whole.size() == input.size());
+        CHECK(SameKeyOrder(whole.data(), input.data(), length));
+
+        for (size_t mask = 1; length > 1 && mask < (size_t(1) << (length - 1)); mask++) {
+            std::vector<size_t> cuts;
+            for (size_t gap = 0; gap + 1 < length; gap++) {
+                if (mask & (size_t(1) << gap)) {
+                    cuts.push_back(gap + 1);
+                }
+            }
+            CHECK(Same(Run(profile, seed, input, cuts), whole));
+
+            // A timeout at every cut releases each batch before the next
+            const Packets flushed = Run(profile, seed, input, cuts, true);
+            CHECK(flushed.size() == input.size());
+            size_t begin = 0;
+            cuts.push_back(length);
+            for (size_t end : cuts) {
+                CHECK(SameKeyOrder(flushed.data() + begin, input.data() + begin, end - begin));
+                begin = end;
+            }
+        }
+
+        size_t i = 0;
+        while (i < length && ++digits[i] == kSymbols) {
+            digits[i++] = 0;
+        }
+        if (i == length) {
+            break;
+        }
+    }
+}
+
+void TestModeSwitch() {
+    const KB_PROFILE transpose = Profile(100);
+    const KB_PROFILE normal = Profile(0, KB_MODE_NORMAL);
+    KB_STREAM stream;
+    KbCoreInitStream(&stream, 1);
+    Packets input = Sequence({ Packet(kA, KEY_MAKE), Packet(kB, KEY_MAKE) });
+    Packets output;
+
+    KbCoreTransformStream(&transpose, &stream, &input[0], &input[1], Collect, &output);
+    CHECK(output.empty());
+    CHECK(KbCoreIsStreaming(&normal, &stream));
+    KbCoreTransformStream(&normal, &stream, &input[1], &input[2], Collect, &output);
+    CHECK(Same(output, input));
+    CHECK(!KbCoreIsStreaming(&normal, &stream));
+}
+
+//
+// Driver: holdback timer
+//
+WDFDEVICE StartTransposing(CONNECT_DATA* connect, ULONG probability) {
+    WDFDEVICE device = kmdf::StartDevice();
+    CHECK(device != nullptr);
+    CHECK(kmdf::Connect(device, connect));
+    CHECK(NT_SUCCESS(kmdf::SetConfig(device, { probability, KB_MODE_TRANSPOSE })));
+    return device;
+}
+
+void TestDriverTimeout() {
+    CONNECT_DATA connect;
+    WDFDEVICE device = StartTransposing(&connect, 100);
+    const Packets& delivered = kmdf::Class().packets;
+
+    Packets input = Sequence({ Packet(kA, KEY_MAKE), Packet(kA, KEY_BREAK), Packet(kB, KEY_MAKE),
+                               Packet(kB, KEY_BREAK), Packet(0x2E, KEY_MAKE) });
+    CHECK(kmdf::Service(connect, input.data(), input.data() + input.size()) == input.size());
+    CHECK(Same(delivered, Sequence({ input[2], input[0], input[1], input[3] })));
+    CHECK(kmdf::ArmedTimers() == 1);
+
+    // Nothing follows the held key: the timeout releases it
+    kmdf::Class().packets.clear();
+    CHECK(kmdf::FireTimers() == 1);
+    CHECK(Same(delivered, Sequence({ input[4] })));
+    CHECK(kmdf::ArmedTimers() == 0);
+
+    // A held key survives a switch to another mode and leads its output
+    kmdf::Class().packets.clear();
+    kmdf::Service(connect, &input[0], &input[1]);
+    CHECK(delivered.empty());
+    CHECK(NT_SUCCESS(kmdf::SetConfig(device, { 0, KB_MODE_NORMAL })));
+    kmdf::Service(connect, &input[1], &input[2]);
+    CHECK(Same(delivered, Sequence({ input[0], input[1] })));
+    CHECK(kmdf::FireTimers() == 1);
+    CHECK(delivered.size() == 2);
+}
+
+// A class driver that stops accepting packets is reported a partial
+// consume, so the port driver keeps the rest. Output it refused is carried
+// over and leads the next callback or timer tick, so nothing is lost.
+void TestDriverShortfall() {
+    CONNECT_DATA connect;
+    StartTransposing(&connect, 0);
+    kmdf::ClassDriver& classDriver = kmdf::Class();
+
+    // Nothing is held at 0%: a chunk the class driver falls short on is
+    // consumed whole, and its refused tail is the carry-over
+    Packets input;
+    for (size_t i = 0; i < 3 * KBFILTR_STAGING_PACKETS; i++) {
+        input.push_back(Packet(i % 2 ? kB : kA, i % 4 < 2 ? KEY_MAKE : KEY_BREAK));
+    }
+    for (size_t capacity : { (size_t)0, (size_t)5, (size_t)KBFILTR_STAGING_PACKETS,
+                             (size_t)KBFILTR_STAGING_PACKETS + 3, input.size() }) {
+        size_t chunkEnd = std::min(input.size(), (capacity / KBFILTR_STAGING_PACKETS + 1) * KBFILTR_STAGING_PACKETS);
+        classDriver.packets.clear();
+        classDriver.capacity = capacity;
+        CHECK(kmdf::Service(connect, input.data(), input.data() + input.size()) == chunkEnd);
+        CHECK(Same(classDriver.packets, Packets(input.begin(), input.begin() + capacity)));
+        CHECK(kmdf::ArmedTimers() == (capacity < chunkEnd ? 1u : 0u));
+
+        classDriver.capacity = SIZE_MAX;
+        kmdf::FireTimers();
+        CHECK(Same(classDriver.packets, Packets(input.begin(), input.begin() + chunkEnd)));
+        CHECK(kmdf::ArmedTimers() == 0);
+    }
+}
+
+// The class driver falls short while held packets are being released
+void TestDriverShortfallHolding() {
+    Packets batches[] = {
+        Sequence({ Packet(kA, KEY_MAKE), Packet(kA, KEY_BREAK) }),
+        Sequence({ Packet(kEnter, KEY_MAKE), Packet(kEnter, KEY_BREAK) }),
+        Sequence({ Packet(kB, KEY_MAKE), Packet(kB, KEY_BREAK) }),
+    };
+
+    Packets expected;
+    for (int shortfall = 0; shortfall < 2; shortfall++) {
+        CONNECT_DATA connect;
+        StartTransposing(&connect, 100);
+        kmdf::ClassDriver& classDriver = kmdf::Class();
+
+        CHECK(kmdf::Service(connect, batches[0].data(), batches[0].data() + 2) == 2);
+        CHECK(classDriver.packets.empty());
+
+        // Releasing the held packets, the class driver takes one
+        classDriver.capacity = shortfall ? 1 : SIZE_MAX;
+        CHECK(kmdf::Service(connect, batches[1].data(), batches[1].data() + 2) == 2);
+        if (shortfall) {
+            CHECK(classDriver.packets.size() == 1);
+            CHECK(kmdf::ArmedTimers() == 1);
+
+            // Still refused: neither the next batch nor the timer gets ahead
+            classDriver.capacity = 0;
+            CHECK(kmdf::Service(connect, batches[2].data(), batches[2].data() + 2) == 0);
+            CHECK(kmdf::FireTimers() == 1);
+            CHECK(classDriver.packets.size() == 1);
+            CHECK(kmdf::ArmedTimers() == 1);
+            classDriver.capacity = SIZE_MAX;
+        }
+
+        // The carry-over leads the next batch
+        CHECK(kmdf::Service(connect, batches[2].data(), batches[2].data() + 2) == 2);
+        kmdf::FireTimers();
+        CHECK(kmdf::ArmedTimers() == 0);
+        CHECK(classDriver.packets.size() == 6);
+        if (shortfall) {
+            CHECK(Same(classDriver.packets, expected));
+        }
+        expected = classDriver.packets;
+    }
+}
+
+}  // namespace
+
+int main() {
+    TestExamples();
+    for (size_t length = 0; length <= kMaxLength; length++) {
+        TestBatchBoundaries(Profile(100), 1, length);
+        TestBatchBoundaries(Profile(50), 7, length);
+    }
+    TestModeSwitch();
+    TestDriverTimeout();
+    TestDriverShortfall();
+    TestDriverShortfallHolding();
+    return CheckResult("transpose_test");
+}
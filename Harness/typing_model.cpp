@@ -0,0 +1,185 @@
+#include "typing_model.h"
+
+namespace {
+
+struct Weighted {
+    USHORT code;
+    ULONG weight;
+};
+
+// Set-1 scan codes weighted by English letter frequency (per mille)
+const Weighted kLetters[] = {
+    { 0x12, 127 }, { 0x14, 91 }, { 0x1E, 82 }, { 0x18, 75 }, { 0x17, 70 }, { 0x31, 67 },
+    { 0x1F, 63 }, { 0x23, 61 }, { 0x13, 60 }, { 0x20, 43 }, { 0x26, 40 }, { 0x2E, 28 },
+    { 0x16, 28 }, { 0x32, 24 }, { 0x11, 24 }, { 0x21, 22 }, { 0x22, 20 }, { 0x15, 20 },
+    { 0x19, 19 }, { 0x30, 15 }, { 0x2F, 10 }, { 0x25, 8 }, { 0x24, 2 }, { 0x2D, 2 },
+    { 0x10, 1 }, { 0x2C, 1 },
+};
+
+// Digits 1-0, then - ; ' , . /
+const USHORT kPunctuation[] = {
+    0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0A, 0x0B,
+    0x0C, 0x27, 0x28, 0x33, 0x34, 0x35,
+};
+
+// E0-prefixed navigation keys: arrows, home, end, page up/down, insert, delete
+const USHORT kNavigation[] = { 0x48, 0x50, 0x4B, 0x4D, 0x47, 0x4F, 0x49, 0x51, 0x52, 0x53 };
+
+// ctrl+ z x c v s a
+const USHORT kShortcuts[] = { 0x2C, 0x2D, 0x2E, 0x2F, 0x1F, 0x1E };
+
+const USHORT kSpace = 0x39;
+const USHORT kEnter = 0x1C;
+const USHORT kBackspace = 0x0E;
+const USHORT kLeftShift = 0x2A;
+const USHORT kRightShift = 0x36;
+const USHORT kCtrl = 0x1D;
+
+// Gesture mix, per 10000 gestures
+const ULONG kRepeatRun = 30;
+const ULONG kNavigationTap = 150;
+const ULONG kShortcut = 50;
+const ULONG kCapital = 250;
+const ULONG kEnterTap = 150;
+const ULONG kBackspaceTap = 250;
+const ULONG kPunctuationTap = 300;
+const ULONG kSpaceTap = 1500;
+
+// Share of plain keystrokes whose break follows the next key's make, per 100
+const ULONG kRollover = 25;
+
+}  // namespace
+
+TypingModel::TypingModel(uint64_t seed) : state_(seed) {
+}
+
+uint64_t TypingModel::Next() {
+    // splitmix64
+    uint64_t z = (state_ += 0x9E3779B97F4A7C15ull);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+ULONG TypingModel::Below(ULONG bound) {
+    return (ULONG)(((Next() >> 32) * bound) >> 32);
+}
+
+USHORT TypingModel::PickLetter() {
+    ULONG total = 0;
+    for (const Weighted& w : kLetters) {
+        total += w.weight;
+    }
+    ULONG r = Below(total);
+    for (const Weighted& w : kLetters) {
+        if (r < w.weight) {
+            return w.code;
+        }
+        r -= w.weight;
+    }
+    return kLetters[0].code;
+}
+
+void TypingModel::Push(std::vector<KEYBOARD_INPUT_DATA>& out, USHORT makeCode, USHORT flags) {
+    // The same key cannot go down again before it has come up
+    if (pending_ && pendingBreak_.MakeCode == makeCode &&
+        (pendingBreak_.Flags & KEY_E0) == (flags & KEY_E0)) {
+        Finish(out);
+    }
+
+    KEYBOARD_INPUT_DATA packet = {};
+    packet.MakeCode = makeCode;
+    packet.Flags = flags;
+    out.push_back(packet);
+
+    // A rolled-over break lands right after the next make
+    if (pending_ && (flags & KEY_BREAK) == 0) {
+        out.push_back(pendingBreak_);
+        pending_ = false;
+    }
+}
+
+void TypingModel::Tap(std::vector<KEYBOARD_INPUT_DATA>& out, USHORT makeCode, USHORT e0) {
+    Push(out, makeCode, KEY_MAKE | e0);
+    if (!pending_ && Below(100) < kRollover) {
+        pendingBreak_ = {};
+        pendingBreak_.MakeCode = makeCode;
+        pendingBreak_.Flags = KEY_BREAK | e0;
+        pending_ = true;
+    } else {
+        Push(out, makeCode, KEY_BREAK | e0);
+    }
+}
+
+void TypingModel::Emit(std::vector<KEYBOARD_INPUT_DATA>& out) {
+    ULONG r = Below(10000);
+
+    if (r < kRepeatRun) {
+        // Held key: typematic makes, one break
+        ULONG pick = Below(3);
+        USHORT code = (pick == 0) ? kBackspace : (pick == 1) ? kNavigation[Below(4)] : PickLetter();
+        USHORT e0 = (pick == 1) ? KEY_E0 : 0;
+        ULONG repeats = 5 + Below(36);
+        for (ULONG i = 0; i < repeats; i++) {
+            Push(out, code, KEY_MAKE | e0);
+        }
+        Push(out, code, KEY_BREAK | e0);
+        return;
+    }
+    r -= kRepeatRun;
+
+    if (r < kNavigationTap) {
+        Tap(out, kNavigation[Below(RTL_NUMBER_OF(kNavigation))], KEY_E0);
+        return;
+    }
+    r -= kNavigationTap;
+
+    if (r < kShortcut) {
+        // Left or right (E0) ctrl held around a letter
+        USHORT e0 = Below(4) == 0 ? KEY_E0 : 0;
+        USHORT code = kShortcuts[Below(RTL_NUMBER_OF(kShortcuts))];
+        Push(out, kCtrl, KEY_MAKE | e0);
+        Push(out, code, KEY_MAKE);
+        Push(out, code, KEY_BREAK);
+        Push(out, kCtrl, KEY_BREAK | e0);
+        return;
+    }
+    r -= kShortcut;
+
+    if (r < kCapital) {
+        USHORT shift = Below(5) == 0 ? kRightShift : kLeftShift;
+        USHORT code = PickLetter();
+        Push(out, shift, KEY_MAKE);
+        Push(out, code, KEY_MAKE);
+        Push(out, code, KEY_BREAK);
+        Push(out, shift, KEY_BREAK);
+        return;
+    }
+    r -= kCapital;
+
+    if (r < kEnterTap) {
+        Tap(out, kEnter, 0);
+    } else if ((r -= kEnterTap) < kBackspaceTap) {
+        Tap(out, kBackspace, 0);
+    } else if ((r -= kBackspaceTap) < kPunctuationTap) {
+        Tap(out, kPunctuation[Below(RTL_NUMBER_OF(kPunctuation))], 0);
+    } else if ((r -= kPunctuationTap) < kSpaceTap) {
+        Tap(out, kSpace, 0);
+    } else {
+        Tap(out, PickLetter(), 0);
+    }
+}
+
+void TypingModel::Finish(std::vector<KEYBOARD_INPUT_DATA>& out) {
+    if (pending_) {
+        out.push_back(pendingBreak_);
+        pending_ = false;
+    }
+}
+
+void TypingModel::Fill(std::vector<KEYBOARD_INPUT_DATA>& out, size_t packets) {
+    while (out.size() < packets) {
+        Emit(out);
+    }
+    Finish(out);
+}
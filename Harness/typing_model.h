@@ -0,0 +1,50 @@
+// Synthetic typing workload: produces KEYBOARD_INPUT_DATA streams that look
+// like a person typing English text on a set-1 keyboard.
+//
+//  - letters follow English letter frequencies; space, punctuation, digits,
+//    enter and backspace are mixed in at typing-like rates
+//  - every make has a matching break; some keystrokes roll over, with the
+//    break arriving after the next key's make
+//  - E0-extended navigation keys (arrows, home/end, delete, ...)
+//  - modifier chords: shift+letter capitals, ctrl+letter shortcuts
+//  - typematic repeat runs: a held key repeating its make code
+//
+// Output depends only on the seed; no library RNG or distribution is used,
+// so corpora are identical across platforms and standard libraries.
+
+#ifndef KB_TYPING_MODEL_H
+#define KB_TYPING_MODEL_H
+
+#include <cstdint>
+#include <vector>
+
+#include "kbport.h"
+
+class TypingModel {
+public:
+    explicit TypingModel(uint64_t seed);
+
+    // Appends one gesture (a keystroke, chord or repeat run) to out
+    void Emit(std::vector<KEYBOARD_INPUT_DATA>& out);
+
+    // Releases a rolled-over key still waiting for its break
+    void Finish(std::vector<KEYBOARD_INPUT_DATA>& out);
+
+    // Appends whole gestures until out holds at least packets entries, then
+    // finishes so the stream ends with nothing held
+    void Fill(std::vector<KEYBOARD_INPUT_DATA>& out, size_t packets);
+
+private:
+    uint64_t Next();
+    ULONG Below(ULONG bound);
+    USHORT PickLetter();
+
+    void Push(std::vector<KEYBOARD_INPUT_DATA>& out, USHORT makeCode, USHORT flags);
+    void Tap(std::vector<KEYBOARD_INPUT_DATA>& out, USHORT makeCode, USHORT e0);
+
+    uint64_t state_;
+    bool pending_ = false;
+    KEYBOARD_INPUT_DATA pendingBreak_ = {};
+};
+
+#endif
@@ -0,0 +1,580 @@
+/*++
+
+Module Name:
+
+    kbcore.c
+
+Abstract:
+
+    Portable keystroke transform engine used by KbFilter_ServiceCallback.
+
+    Every (mode, sampling strategy) pair gets its own kernel, generated
+    from one force-inlined body with both parameters passed as constants,
+    so each instantiation is a tight loop with the dead branches folded
+    away. KbCoreCompileProfile picks the instantiation from a table.
+
+Environment:
+
+    Kernel mode or user mode. Callable at DISPATCH_LEVEL; no allocation.
+
+--*/
+
+#include "kbcore.h"
+
+const USHORT AllowedScanCodes[ALLOWED_SCAN_CODE_COUNT] = {
+    0x0E, 0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19,
+    0x1E, 0x1F, 0x20, 0x21, 0x22, 0x23, 0x24, 0x25, 0x26, 0x2C, 0x2D, 0x2E, 0x2F, 0x30, 0x31, 0x32
+};
+
+#define SCAN_CODE_SPACE 0x39
+
+// Units of KB_CONFIG::Probability and of the burst transition chances
+#define KB_PERCENT_SCALE    100
+#define KB_BURST_SCALE      10000
+
+ULONG
+KbCoreRandom(
+    PULONG Seed
+)
+{
+    *Seed = (*Seed * 1103515245 + 12345) & 0x7FFFFFFF;
+    return *Seed;
+}
+
+VOID
+KbCoreInitStream(
+    PKB_STREAM Stream,
+    ULONG Seed
+)
+{
+    RtlZeroMemory(Stream, sizeof(*Stream));
+    Stream->Seed = Seed;
+}
+
+FORCEINLINE
+VOID
+KbCoreCount(
+    PKB_STREAM Stream,
+    ULONG Action,
+    USHORT MakeCode
+)
+{
+    Stream->Histogram.Counts[Action][MakeCode & (KB_HISTOGRAM_CODES - 1)]++;
+}
+
+FORCEINLINE
+BOOLEAN
+KbCoreBurstSample(
+    const KB_PROFILE* Profile,
+    PULONG Seed,
+    PULONG State
+)
+/*++
+
+Routine Description:
+
+    One make code of the Gilbert-Elliott model: possibly switch between
+    the good and bad state, then flip the new state's coin. Two draws,
+    compared whole against precomputed thresholds, so the chances are
+    exact to 2^-31 and do not lean on the generator's weak low bits.
+
+--*/
+{
+    if (KbCoreRandom(Seed) < Profile->SwitchThreshold[*State]) {
+        *State ^= 1;
+    }
+    return KbCoreRandom(Seed) < Profile->InjectThreshold[*State];
+}
+
+// Keys that type a character: digits, letters, punctuation and space
+FORCEINLINE
+BOOLEAN
+KbCoreIsTypingKey(
+    USHORT MakeCode
+)
+{
+    return (MakeCode >= 0x02 && MakeCode <= 0x0D) ||
+           (MakeCode >= 0x10 && MakeCode <= 0x1B) ||
+           (MakeCode >= 0x1E && MakeCode <= 0x29) ||
+           (MakeCode >= 0x2B && MakeCode <= 0x35) ||
+           MakeCode == SCAN_CODE_SPACE;
+}
+
+VOID
+KbCoreTransformGeneric(
+    const KB_PROFILE* Profile,
+    PKB_STREAM Stream,
+    PKEYBOARD_INPUT_DATA InputDataStart,
+    PKEYBOARD_INPUT_DATA InputDataEnd
+)
+{
+    PKEYBOARD_INPUT_DATA currentPacket;
+
+    for (currentPacket = InputDataStart; currentPacket < InputDataEnd; currentPacket++) {
+
+        // Modify only the 'Make' (key down) code to avoid stuck keys
+        if (currentPacket->Flags == KEY_MAKE) {
+            BOOLEAN inject;
+
+            if (Profile->Sample == KB_SAMPLE_BURST) {
+                inject = KbCoreBurstSample(Profile, &Stream->Seed, &Stream->BurstState);
+            }
+            else {
+                KbCoreRandom(&Stream->Seed);
+
+                // Check probability
+                inject = (Stream->Seed % 100) < Profile->Config.Probability;
+            }
+
+            if (inject) {
+                if (Profile->Config.Mode == KB_MODE_CHAOS) {
+                    KbCoreCount(Stream, KB_ACTION_SWAPPED_OUT, currentPacket->MakeCode);
+                    currentPacket->MakeCode = AllowedScanCodes[Stream->Seed % ALLOWED_SCAN_CODE_COUNT];
+                    KbCoreCount(Stream, KB_ACTION_SWAPPED_IN, currentPacket->MakeCode);
+                }
+                else if (Profile->Config.Mode == KB_MODE_DROP) {
+                    KbCoreCount(Stream, KB_ACTION_DROPPED, currentPacket->MakeCode);
+                    currentPacket->Flags = KEY_BREAK;
+                }
+                else if (Profile->Config.Mode == KB_MODE_DROP_SPACE) {
+                    if (currentPacket->MakeCode == SCAN_CODE_SPACE) {
+                        KbCoreCount(Stream, KB_ACTION_DROPPED, SCAN_CODE_SPACE);
+                        currentPacket->MakeCode = KEY_BREAK;
+                    }
+                }
+            }
+        }
+    }
+}
+
+FORCEINLINE
+VOID
+KbCoreKernelBody(
+    const KB_PROFILE* Profile,
+    PKB_STREAM Stream,
+    PKEYBOARD_INPUT_DATA InputDataStart,
+    PKEYBOARD_INPUT_DATA InputDataEnd,
+    const ULONG Mode,
+    const ULONG Sample
+)
+/*++
+
+Routine Description:
+
+    Shared body of the specialized kernels. Mode and Sample are always
+    literals at the call site. The seed is only advanced when the outcome
+    depends on it (coin flips, or picking a chaos replacement), and is kept
+    in a local for the duration of the batch, as is the burst state. The
+    histogram is touched only on the injection branch.
+
+--*/
+{
+    const ULONG probability = Profile->Config.Probability;
+    ULONG seed = Stream->Seed;
+    ULONG burstState = Stream->BurstState;
+    PKEYBOARD_INPUT_DATA currentPacket;
+
+    for (currentPacket = InputDataStart; currentPacket < InputDataEnd; currentPacket++) {
+
+        if (currentPacket->Flags != KEY_MAKE) {
+            continue;
+        }
+
+        if (Sample == KB_SAMPLE_BURST) {
+            if (!KbCoreBurstSample(Profile, &seed, &burstState)) {
+                continue;
+            }
+        }
+        else {
+            if (Sample == KB_SAMPLE_COIN || Mode == KB_MODE_CHAOS) {
+                KbCoreRandom(&seed);
+            }
+
+            if (Sample == KB_SAMPLE_COIN && (seed % 100) >= probability) {
+                continue;
+            }
+        }
+
+        if (Mode == KB_MODE_CHAOS) {
+            KbCoreCount(Stream, KB_ACTION_SWAPPED_OUT, currentPacket->MakeCode);
+            currentPacket->MakeCode = AllowedScanCodes[seed % ALLOWED_SCAN_CODE_COUNT];
+            KbCoreCount(Stream, KB_ACTION_SWAPPED_IN, currentPacket->MakeCode);
+        }
+        else if (Mode == KB_MODE_DROP) {
+            KbCoreCount(Stream, KB_ACTION_DROPPED, currentPacket->MakeCode);
+            currentPacket->Flags = KEY_BREAK;
+        }
+        else if (Mode == KB_MODE_DROP_SPACE) {
+            if (currentPacket->MakeCode == SCAN_CODE_SPACE) {
+                KbCoreCount(Stream, KB_ACTION_DROPPED, SCAN_CODE_SPACE);
+                currentPacket->MakeCode = KEY_BREAK;
+            }
+        }
+    }
+
+    Stream->Seed = seed;
+    Stream->BurstState = burstState;
+}
+
+static
+VOID
+KbCoreKernelPassThrough(
+    const KB_PROFILE* Profile,
+    PKB_STREAM Stream,
+    PKEYBOARD_INPUT_DATA InputDataStart,
+    PKEYBOARD_INPUT_DATA InputDataEnd
+)
+{
+    UNREFERENCED_PARAMETER(Profile);
+    UNREFERENCED_PARAMETER(Stream);
+    UNREFERENCED_PARAMETER(InputDataStart);
+    UNREFERENCED_PARAMETER(InputDataEnd);
+}
+
+#define KB_DEFINE_KERNEL(_mode, _sample)                                    \
+    static                                                                  \
+    VOID                                                                    \
+    KbCoreKernel_##_mode##_##_sample(                                       \
+        const KB_PROFILE* Profile,                                          \
+        PKB_STREAM Stream,                                                  \
+        PKEYBOARD_INPUT_DATA InputDataStart,                                \
+        PKEYBOARD_INPUT_DATA InputDataEnd                                   \
+    )                                                                       \
+    {                                                                       \
+        KbCoreKernelBody(Profile, Stream, InputDataStart, InputDataEnd,     \
+            _mode, _sample);                                                \
+    }
+
+KB_DEFINE_KERNEL(KB_MODE_CHAOS, KB_SAMPLE_COIN)
+KB_DEFINE_KERNEL(KB_MODE_CHAOS, KB_SAMPLE_ALWAYS)
+KB_DEFINE_KERNEL(KB_MODE_DROP, KB_SAMPLE_COIN)
+KB_DEFINE_KERNEL(KB_MODE_DROP, KB_SAMPLE_ALWAYS)
+KB_DEFINE_KERNEL(KB_MODE_DROP_SPACE, KB_SAMPLE_COIN)
+KB_DEFINE_KERNEL(KB_MODE_DROP_SPACE, KB_SAMPLE_ALWAYS)
+KB_DEFINE_KERNEL(KB_MODE_CHAOS, KB_SAMPLE_BURST)
+KB_DEFINE_KERNEL(KB_MODE_DROP, KB_SAMPLE_BURST)
+KB_DEFINE_KERNEL(KB_MODE_DROP_SPACE, KB_SAMPLE_BURST)
+
+static PKB_TRANSFORM_KERNEL const KbCoreKernels[KB_MODE_COUNT][KB_SAMPLE_COUNT] = {
+    // KB_SAMPLE_NEVER, KB_SAMPLE_COIN, KB_SAMPLE_ALWAYS, KB_SAMPLE_BURST
+    { KbCoreKernelPassThrough, KbCoreKernelPassThrough, KbCoreKernelPassThrough, KbCoreKernelPassThrough },
+    { KbCoreKernelPassThrough, KbCoreKernel_KB_MODE_CHAOS_KB_SAMPLE_COIN, KbCoreKernel_KB_MODE_CHAOS_KB_SAMPLE_ALWAYS, KbCoreKernel_KB_MODE_CHAOS_KB_SAMPLE_BURST },
+    { KbCoreKernelPassThrough, KbCoreKernel_KB_MODE_DROP_KB_SAMPLE_COIN, KbCoreKernel_KB_MODE_DROP_KB_SAMPLE_ALWAYS, KbCoreKernel_KB_MODE_DROP_KB_SAMPLE_BURST },
+    { KbCoreKernelPassThrough, KbCoreKernel_KB_MODE_DROP_SPACE_KB_SAMPLE_COIN, KbCoreKernel_KB_MODE_DROP_SPACE_KB_SAMPLE_ALWAYS, KbCoreKernel_KB_MODE_DROP_SPACE_KB_SAMPLE_BURST },
+    // KB_MODE_TRANSPOSE: see KbCoreTransformStream
+    { KbCoreKernelPassThrough, KbCoreKernelPassThrough, KbCoreKernelPassThrough, KbCoreKernelPassThrough },
+};
+
+FORCEINLINE
+VOID
+KbCoreEmit(
+    PKB_EMIT_ROUTINE Emit,
+    PVOID Context,
+    PKEYBOARD_INPUT_DATA InputDataStart,
+    PKEYBOARD_INPUT_DATA InputDataEnd
+)
+{
+    if (InputDataStart < InputDataEnd) {
+        Emit(Context, InputDataStart, InputDataEnd);
+    }
+}
+
+VOID
+KbCoreFlushStream(
+    PKB_STREAM Stream,
+    PKB_EMIT_ROUTINE Emit,
+    PVOID Context
+)
+/*++
+
+Routine Description:
+
+    Releases the packets held for transposition, untransposed. Called when
+    the lookahead ends: on timeout, or when the next packet is not a typed
+    key that can take the held key's place.
+
+--*/
+{
+    ULONG count = Stream->HeldCount;
+
+    Stream->HeldCount = 0;
+    KbCoreEmit(Emit, Context, Stream->Held, Stream->Held + count);
+}
+
+static
+VOID
+KbCoreTranspose(
+    const KB_PROFILE* Profile,
+    PKB_STREAM Stream,
+    PKEYBOARD_INPUT_DATA InputDataStart,
+    PKEYBOARD_INPUT_DATA InputDataEnd,
+    PKB_EMIT_ROUTINE Emit,
+    PVOID Context
+)
+/*++
+
+Routine Description:
+
+    KB_MODE_TRANSPOSE. A selected typed make (A) is held back, with its
+    break if that comes next, until the next packet decides:
+
+        make of another typed key B     emit B, then the held A
+        break of A (only A held)        hold it too
+        anything else                   release A, then handle the packet
+
+    so "A B" comes out as "B A". Unselected packets are emitted as
+    contiguous runs of the input. At most one packet enters or leaves the
+    slot per input packet, and the slot is part of the stream, so the
+    lookahead crosses callback boundaries without any allocation.
+
+--*/
+{
+    const ULONG probability = Profile->Config.Probability;
+    const ULONG sample = Profile->Sample;
+    ULONG seed = Stream->Seed;
+    PKEYBOARD_INPUT_DATA run = InputDataStart;      // first packet not yet emitted
+    PKEYBOARD_INPUT_DATA currentPacket;
+
+    for (currentPacket = InputDataStart; currentPacket < InputDataEnd; currentPacket++) {
+
+        if (Stream->HeldCount != 0) {
+            const USHORT heldCode = Stream->Held[0].MakeCode;
+
+            if (Stream->HeldCount == 1 &&
+                currentPacket->Flags == KEY_BREAK && currentPacket->MakeCode == heldCode) {
+                KbCoreEmit(Emit, Context, run, currentPacket);
+                Stream->Held[1] = *currentPacket;
+                Stream->HeldCount = 2;
+                run = currentPacket + 1;
+                continue;
+            }
+
+            if (currentPacket->Flags == KEY_MAKE && currentPacket->MakeCode != heldCode &&
+                KbCoreIsTypingKey(currentPacket->MakeCode)) {
+                KbCoreCount(Stream, KB_ACTION_TRANSPOSED, heldCode);
+                KbCoreEmit(Emit, Context, run, currentPacket + 1);
+                KbCoreFlushStream(Stream, Emit, Context);
+                run = currentPacket + 1;
+                continue;
+            }
+
+            KbCoreEmit(Emit, Context, run, currentPacket);
+            KbCoreFlushStream(Stream, Emit, Context);
+            run = currentPacket;
+        }
+
+        if (currentPacket->Flags != KEY_MAKE || !KbCoreIsTypingKey(currentPacket->MakeCode)) {
+            continue;
+        }
+
+        if (sample == KB_SAMPLE_BURST) {
+            if (!KbCoreBurstSample(Profile, &seed, &Stream->BurstState)) {
+                continue;
+            }
+        }
+        else if (sample == KB_SAMPLE_COIN && (KbCoreRandom(&seed) % 100) >= probability) {
+            continue;
+        }
+
+        KbCoreEmit(Emit, Context, run, currentPacket);
+        Stream->Held[0] = *currentPacket;
+        Stream->HeldCount = 1;
+        run = currentPacket + 1;
+    }
+
+    KbCoreEmit(Emit, Context, run, InputDataEnd);
+    Stream->Seed = seed;
+}
+
+VOID
+KbCoreTransformStream(
+    const KB_PROFILE* Profile,
+    PKB_STREAM Stream,
+    PKEYBOARD_INPUT_DATA InputDataStart,
+    PKEYBOARD_INPUT_DATA InputDataEnd,
+    PKB_EMIT_ROUTINE Emit,
+    PVOID Context
+)
+/*++
+
+Routine Description:
+
+    Transforms a batch and hands the result to Emit, possibly in several
+    segments. Packets held by KB_MODE_TRANSPOSE stay in Stream until a
+    later call or KbCoreFlushStream releases them.
+
+    Callers that find KbCoreIsStreaming FALSE may use KbCoreTransform and
+    forward the batch as is; the result is the same.
+
+--*/
+{
+    if (Profile->Config.Mode == KB_MODE_TRANSPOSE && Profile->Sample != KB_SAMPLE_NEVER) {
+        KbCoreTranspose(Profile, Stream, InputDataStart, InputDataEnd, Emit, Context);
+        return;
+    }
+
+    // Nothing to hold; release anything held under an earlier config
+    KbCoreFlushStream(Stream, Emit, Context);
+    KbCoreTransform(Profile, Stream, InputDataStart, InputDataEnd);
+    KbCoreEmit(Emit, Context, InputDataStart, InputDataEnd);
+}
+
+// Chance / Scale as a bound on KbCoreRandom's 31-bit output
+static
+ULONG
+KbCoreThreshold(
+    ULONG Chance,
+    ULONG Scale
+)
+{
+    return (ULONG)(((ULONGLONG)Chance << 31) / Scale);
+}
+
+BOOLEAN
+KbCoreCompileProfile(
+    PKB_PROFILE Profile,
+    const KB_CONFIG* Config
+)
+/*++
+
+Routine Description:
+
+    Validates Config and selects the kernel for it. Unknown modes are
+    accepted, as they always have been, and behave as pass-through.
+    A non-zero EnterBad selects the Gilbert-Elliott model.
+
+Return Value:
+
+    FALSE if the config is invalid; Profile is left untouched in that case.
+
+--*/
+{
+    ULONG sample;
+
+    if (Config->Probability > KB_PERCENT_SCALE || Config->BadProbability > KB_PERCENT_SCALE ||
+        Config->EnterBad > KB_BURST_SCALE || Config->ExitBad > KB_BURST_SCALE) {
+        return FALSE;
+    }
+
+    if (Config->EnterBad != 0) {
+        sample = (Config->Probability == 0 && Config->BadProbability == 0) ?
+            KB_SAMPLE_NEVER : KB_SAMPLE_BURST;
+    }
+    else if (Config->Probability == 0) {
+        sample = KB_SAMPLE_NEVER;
+    }
+    else if (Config->Probability == 100) {
+        sample = KB_SAMPLE_ALWAYS;
+    }
+    else {
+        sample = KB_SAMPLE_COIN;
+    }
+
+    Profile->Config = *Config;
+    Profile->Sample = sample;
+    Profile->InjectThreshold[KB_BURST_GOOD] = KbCoreThreshold(Config->Probability, KB_PERCENT_SCALE);
+    Profile->InjectThreshold[KB_BURST_BAD] = KbCoreThreshold(Config->BadProbability, KB_PERCENT_SCALE);
+    Profile->SwitchThreshold[KB_BURST_GOOD] = KbCoreThreshold(Config->EnterBad, KB_BURST_SCALE);
+    Profile->SwitchThreshold[KB_BURST_BAD] = KbCoreThreshold(Config->ExitBad, KB_BURST_SCALE);
+    Profile->Kernel = (Config->Mode < KB_MODE_COUNT) ?
+        KbCoreKernels[Config->Mode][sample] : KbCoreKernelPassThrough;
+
+    return TRUE;
+}
+
+static
+ULONG
+KbCoreChecksum(
+    const UCHAR* Data,
+    ULONG Length
+)
+{
+    ULONG hash = 2166136261u;
+    ULONG i;
+
+    for (i = 0; i < Length; i++) {
+        hash = (hash ^ Data[i]) * 16777619u;
+    }
+    return hash;
+}
+
+BOOLEAN
+KbCoreLoadConfigBlob(
+    const VOID* Blob,
+    ULONG Length,
+    PKB_CONFIG Config
+)
+/*++
+
+Routine Description:
+
+    Validates a persisted config blob and extracts the KB_CONFIG from it.
+    The config must also pass KbCoreCompileProfile.
+
+Return Value:
+
+    FALSE if the blob is malformed or the config invalid; Config is left
+    untouched in that case.
+
+--*/
+{
+    const KB_CONFIG_BLOB_HEADER* header = (const KB_CONFIG_BLOB_HEADER*)Blob;
+    const UCHAR* payload = (const UCHAR*)Blob + sizeof(KB_CONFIG_BLOB_HEADER);
+    KB_CONFIG config;
+    KB_PROFILE profile;
+    ULONG copy;
+
+    if (Blob == NULL || Length < sizeof(KB_CONFIG_BLOB_HEADER) ||
+        header->Signature != KB_CONFIG_BLOB_SIGNATURE ||
+        header->Version != KB_CONFIG_BLOB_VERSION ||
+        header->ConfigSize < KB_CONFIG_BLOB_MIN_CONFIG ||
+        header->ConfigSize > Length - sizeof(KB_CONFIG_BLOB_HEADER) ||
+        header->Checksum != KbCoreChecksum(payload, header->ConfigSize)) {
+        return FALSE;
+    }
+
+    copy = (header->ConfigSize < sizeof(KB_CONFIG)) ? header->ConfigSize : sizeof(KB_CONFIG);
+    RtlZeroMemory(&config, sizeof(config));
+    RtlCopyMemory(&config, payload, copy);
+
+    if (!KbCoreCompileProfile(&profile, &config)) {
+        return FALSE;
+    }
+
+    *Config = config;
+    return TRUE;
+}
+
+ULONG
+KbCoreSaveConfigBlob(
+    const KB_CONFIG* Config,
+    PVOID Blob,
+    ULONG Length
+)
+/*++
+
+Routine Description:
+
+    Serializes Config as a persisted config blob.
+
+Return Value:
+
+    Number of bytes written, or 0 if Length is too small.
+
+--*/
+{
+    PKB_CONFIG_BLOB_HEADER header = (PKB_CONFIG_BLOB_HEADER)Blob;
+    ULONG size = sizeof(KB_CONFIG_BLOB_HEADER) + sizeof(KB_CONFIG);
+
+    if (Length < size) {
+        return 0;
+    }
+
+    header->Signature = KB_CONFIG_BLOB_SIGNATURE;
+    header->Version = KB_CONFIG_BLOB_VERSION;
+    header->ConfigSize = sizeof(KB_CONFIG);
+    RtlCopyMemory(header + 1, Config, sizeof(KB_CONFIG));
+    header->Checksum = KbCoreChecksum((const UCHAR*)(header + 1), sizeof(KB_CONFIG));
+
+    return size;
+}
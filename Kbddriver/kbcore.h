@@ -0,0 +1,169 @@
+/*++
+
+Module Name:
+
+    kbcore.h
+
+Abstract:
+
+    Portable keystroke transform engine. This is the packet-rewriting logic
+    of KbFilter_ServiceCallback, split out so that it has no WDF dependency
+    and can be built both into the driver and into the Linux harness.
+
+    The active KB_CONFIG is compiled into a KB_PROFILE, which carries a
+    kernel specialized on mode and sampling strategy. The choice is made
+    once per config change, not once per packet.
+
+    Kernels rewrite packets in place. KB_MODE_TRANSPOSE reorders packets
+    across callbacks instead, so it runs through KbCoreTransformStream,
+    which hands its output to an emit routine in segments.
+
+Environment:
+
+    Kernel mode or user mode.
+
+--*/
+#ifndef KBCORE_H
+#define KBCORE_H
+
+#if defined(_KERNEL_MODE)
+#include <ntddk.h>
+#include <ntddkbd.h>
+#else
+#include "kbport.h"
+#endif
+#include "public.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Sampling strategy, derived from KB_CONFIG::Probability
+#define KB_SAMPLE_NEVER         0   // probability 0, nothing is touched
+#define KB_SAMPLE_COIN          1   // per make code coin flip
+#define KB_SAMPLE_ALWAYS        2   // probability 100, every make code
+#define KB_SAMPLE_BURST         3   // Gilbert-Elliott two-state model
+#define KB_SAMPLE_COUNT         4
+
+#define KB_BURST_GOOD           0
+#define KB_BURST_BAD            1
+
+// Replacement codes for KB_MODE_CHAOS: letters and backspace
+#define ALLOWED_SCAN_CODE_COUNT 27
+extern const USHORT AllowedScanCodes[ALLOWED_SCAN_CODE_COUNT];
+
+// Holdback slot of KB_MODE_TRANSPOSE: a make and, at most, its break
+#define KB_HOLDBACK_SLOTS       2
+
+// Per-device mutable engine state. The histogram is only written when a
+// packet is actually changed.
+typedef struct _KB_STREAM {
+    ULONG Seed;
+    ULONG BurstState;       // KB_BURST_GOOD or KB_BURST_BAD
+    ULONG HeldCount;
+    KEYBOARD_INPUT_DATA Held[KB_HOLDBACK_SLOTS];
+    KB_HISTOGRAM Histogram;
+} KB_STREAM, * PKB_STREAM;
+
+// Receives transformed packets, in order; the range is only valid for the
+// duration of the call
+typedef VOID KB_EMIT_ROUTINE(
+    PVOID Context,
+    PKEYBOARD_INPUT_DATA InputDataStart,
+    PKEYBOARD_INPUT_DATA InputDataEnd
+);
+typedef KB_EMIT_ROUTINE* PKB_EMIT_ROUTINE;
+
+struct _KB_PROFILE;
+
+typedef VOID KB_TRANSFORM_KERNEL(
+    const struct _KB_PROFILE* Profile,
+    PKB_STREAM Stream,
+    PKEYBOARD_INPUT_DATA InputDataStart,
+    PKEYBOARD_INPUT_DATA InputDataEnd
+);
+typedef KB_TRANSFORM_KERNEL* PKB_TRANSFORM_KERNEL;
+
+// Validated config plus the kernel selected for it. For KB_SAMPLE_BURST
+// the chances are precomputed as thresholds on the 31-bit random value,
+// indexed by state.
+typedef struct _KB_PROFILE {
+    KB_CONFIG Config;
+    ULONG Sample;
+    PKB_TRANSFORM_KERNEL Kernel;
+    ULONG InjectThreshold[2];
+    ULONG SwitchThreshold[2];
+} KB_PROFILE, * PKB_PROFILE;
+
+//
+// Persisted config blob, stored as REG_BINARY under the service's
+// Parameters key: a header followed by ConfigSize bytes of KB_CONFIG.
+// Blobs written by an older driver (smaller ConfigSize) load with the
+// missing fields zeroed; fields unknown to this driver are ignored.
+//
+#define KB_CONFIG_BLOB_SIGNATURE    0x4643424B  // 'KBCF'
+#define KB_CONFIG_BLOB_VERSION      1
+#define KB_CONFIG_BLOB_MIN_CONFIG   KB_CONFIG_LEGACY_SIZE
+#define KB_CONFIG_BLOB_MAX_SIZE     256
+
+typedef struct _KB_CONFIG_BLOB_HEADER {
+    ULONG Signature;
+    ULONG Version;
+    ULONG ConfigSize;
+    ULONG Checksum;     // FNV-1a over the config bytes
+} KB_CONFIG_BLOB_HEADER, * PKB_CONFIG_BLOB_HEADER;
+
+BOOLEAN KbCoreLoadConfigBlob(const VOID* Blob, ULONG Length, PKB_CONFIG Config);
+
+ULONG KbCoreSaveConfigBlob(const KB_CONFIG* Config, PVOID Blob, ULONG Length);
+
+ULONG KbCoreRandom(PULONG Seed);
+
+VOID KbCoreInitStream(PKB_STREAM Stream, ULONG Seed);
+
+BOOLEAN KbCoreCompileProfile(PKB_PROFILE Profile, const KB_CONFIG* Config);
+
+// Reference implementation: re-decides mode and probability on every packet
+KB_TRANSFORM_KERNEL KbCoreTransformGeneric;
+
+VOID
+KbCoreTransformStream(
+    const KB_PROFILE* Profile,
+    PKB_STREAM Stream,
+    PKEYBOARD_INPUT_DATA InputDataStart,
+    PKEYBOARD_INPUT_DATA InputDataEnd,
+    PKB_EMIT_ROUTINE Emit,
+    PVOID Context
+);
+
+VOID KbCoreFlushStream(PKB_STREAM Stream, PKB_EMIT_ROUTINE Emit, PVOID Context);
+
+// TRUE when packets must go through KbCoreTransformStream: transposition
+// is active, or packets it held are still waiting to be released
+FORCEINLINE
+BOOLEAN
+KbCoreIsStreaming(
+    const KB_PROFILE* Profile,
+    const KB_STREAM* Stream
+)
+{
+    return Profile->Config.Mode == KB_MODE_TRANSPOSE || Stream->HeldCount != 0;
+}
+
+FORCEINLINE
+VOID
+KbCoreTransform(
+    const KB_PROFILE* Profile,
+    PKB_STREAM Stream,
+    PKEYBOARD_INPUT_DATA InputDataStart,
+    PKEYBOARD_INPUT_DATA InputDataEnd
+)
+{
+    Profile->Kernel(Profile, Stream, InputDataStart, InputDataEnd);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -26,24 +26,128 @@ Environment:
 
 #ifdef ALLOC_PRAGMA
 #pragma alloc_text (INIT, DriverEntry)
+#pragma alloc_text (INIT, KbFilter_LoadPersistedConfig)
+#pragma alloc_text (PAGE, KbFilter_PublishProfile)
+#pragma alloc_text (PAGE, KbFilter_EvtDriverUnload)
+#pragma alloc_text (PAGE, KbFilter_PersistConfig)
 #pragma alloc_text (PAGE, KbFilter_EvtDeviceAdd)
 #pragma alloc_text (PAGE, KbFilter_EvtIoInternalDeviceControl)
 #endif
 
 ULONG InstanceNo = 0;
-ULONG g_Probability = 10;
-ULONG g_Mode = 1;
-ULONG g_RandomSeed = 0;
 
-ULONG Random(PULONG Seed) {
-    *Seed = (*Seed * 1103515245 + 12345) & 0x7FFFFFFF;
-    return *Seed;
-}
+// Active config, compiled into a specialized kernel on every change. The
+// profile is immutable once published: a change allocates a new one and
+// swaps the pointer, so the service callback never sees a torn copy.
+PKB_PROFILE volatile g_Profile = NULL;
+
+// Callers between KbFilter_ReferenceProfile and KbFilter_DereferenceProfile;
+// a replaced profile is freed only once this drops to zero
+static volatile LONG g_ProfileReaders = 0;
 
-VOID InitRandomSeed() {
+ULONG QueryRandomSeed() {
     LARGE_INTEGER time;
     KeQuerySystemTime(&time);
-    g_RandomSeed = time.LowPart;
+    return time.LowPart;
+}
+
+static PKB_PROFILE
+KbFilter_ReferenceProfile(VOID)
+{
+    // The increment is a full barrier, so a publisher that swaps the
+    // pointer after it sees the reader and waits before freeing
+    InterlockedIncrement(&g_ProfileReaders);
+    return g_Profile;
+}
+
+static VOID
+KbFilter_DereferenceProfile(VOID)
+{
+    InterlockedDecrement(&g_ProfileReaders);
+}
+
+NTSTATUS
+KbFilter_PublishProfile(
+    IN const KB_CONFIG* Config
+)
+/*++
+
+Routine Description:
+
+    Compiles Config into a new profile and makes it the active one. The
+    previous profile is freed once no service callback still uses it.
+    Must be called at PASSIVE_LEVEL, since it may wait for readers.
+
+Arguments:
+
+    Config - The config to activate
+
+Return Value:
+
+    STATUS_INVALID_PARAMETER if Config does not validate (the active
+    profile is then unchanged), STATUS_INSUFFICIENT_RESOURCES if no profile
+    could be allocated, STATUS_SUCCESS otherwise.
+
+--*/
+{
+    PKB_PROFILE     profile;
+    PKB_PROFILE     retired;
+    LARGE_INTEGER   interval;
+
+    PAGED_CODE();
+
+    profile = (PKB_PROFILE)ExAllocatePoolWithTag(NonPagedPoolNx, sizeof(KB_PROFILE), KBFILTER_POOL_TAG);
+    if (profile == NULL) {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    if (!KbCoreCompileProfile(profile, Config)) {
+        ExFreePoolWithTag(profile, KBFILTER_POOL_TAG);
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    retired = (PKB_PROFILE)InterlockedExchangePointer((PVOID volatile*)&g_Profile, profile);
+    if (retired == NULL) {
+        return STATUS_SUCCESS;
+    }
+
+    // Readers hold a reference only for the length of one transform
+    interval.QuadPart = -10000;     // 1 ms, relative
+    while (g_ProfileReaders != 0) {
+        KeDelayExecutionThread(KernelMode, FALSE, &interval);
+    }
+
+    ExFreePoolWithTag(retired, KBFILTER_POOL_TAG);
+    return STATUS_SUCCESS;
+}
+
+VOID
+KbFilter_EvtDriverUnload(
+    IN WDFDRIVER Driver
+)
+/*++
+
+Routine Description:
+
+    Frees the active profile. Every device is gone by now, so no service
+    callback can still reference it.
+
+Arguments:
+
+    Driver - Handle to the framework driver object
+
+--*/
+{
+    PKB_PROFILE profile;
+
+    UNREFERENCED_PARAMETER(Driver);
+
+    PAGED_CODE();
+
+    profile = (PKB_PROFILE)InterlockedExchangePointer((PVOID volatile*)&g_Profile, NULL);
+    if (profile != NULL) {
+        ExFreePoolWithTag(profile, KBFILTER_POOL_TAG);
+    }
 }
 
 NTSTATUS
@@ -74,21 +178,148 @@ Return Value:
 {
     WDF_DRIVER_CONFIG               config;
     NTSTATUS                        status;
-
-    InitRandomSeed();
+    KB_CONFIG                       defaultConfig = { 10, KB_MODE_CHAOS };
+    WDFDRIVER                       hDriver;
 
     WDF_DRIVER_CONFIG_INIT(
         &config,
         KbFilter_EvtDeviceAdd
     );
+    config.EvtDriverUnload = KbFilter_EvtDriverUnload;
 
     status = WdfDriverCreate(DriverObject,
         RegistryPath,
         WDF_NO_OBJECT_ATTRIBUTES,
         &config,
-        WDF_NO_HANDLE); // hDriver optional
+        &hDriver);
     if (!NT_SUCCESS(status)) {
         DebugPrint(("WdfDriverCreate failed with status 0x%x\n", status));
+        return status;
+    }
+
+    status = KbFilter_PublishProfile(&defaultConfig);
+    if (!NT_SUCCESS(status)) {
+        DebugPrint(("KbFilter_PublishProfile failed with status 0x%x\n", status));
+        return status;
+    }
+
+    // No device can be added before DriverEntry returns, so the persisted
+    // config is active before the first keyboard connects.
+    KbFilter_LoadPersistedConfig(hDriver);
+
+    return status;
+}
+
+VOID
+KbFilter_LoadPersistedConfig(
+    IN WDFDRIVER Driver
+)
+/*++
+
+Routine Description:
+
+    Replaces the default config with the one persisted under the service's
+    Parameters key, if there is one and it validates.
+
+Arguments:
+
+    Driver - Handle to the framework driver object
+
+Return Value:
+
+    None. A missing or invalid blob leaves the default config active.
+
+--*/
+{
+    NTSTATUS    status;
+    WDFKEY      hKey;
+    UCHAR       blob[KB_CONFIG_BLOB_MAX_SIZE];
+    ULONG       length = 0;
+    ULONG       type = 0;
+    KB_CONFIG   persisted;
+    DECLARE_CONST_UNICODE_STRING(valueName, KBFILTR_CONFIG_VALUE_NAME);
+
+    PAGED_CODE();
+
+    status = WdfDriverOpenParametersRegistryKey(Driver,
+        KEY_READ,
+        WDF_NO_OBJECT_ATTRIBUTES,
+        &hKey);
+    if (!NT_SUCCESS(status)) {
+        DebugPrint(("WdfDriverOpenParametersRegistryKey failed 0x%x\n", status));
+        return;
+    }
+
+    status = WdfRegistryQueryValue(hKey, &valueName, sizeof(blob), blob, &length, &type);
+    WdfRegistryClose(hKey);
+
+    if (!NT_SUCCESS(status)) {
+        DebugPrint(("No persisted config (0x%x)\n", status));
+        return;
+    }
+
+    if (type != REG_BINARY ||
+        !KbCoreLoadConfigBlob(blob, length, &persisted) ||
+        !NT_SUCCESS(KbFilter_PublishProfile(&persisted))) {
+        DebugPrint(("Persisted config rejected, keeping default\n"));
+        return;
+    }
+
+    DebugPrint(("KbFilter: persisted Mode %lu, Prob %lu\n", persisted.Mode, persisted.Probability));
+}
+
+NTSTATUS
+KbFilter_PersistConfig(
+    IN WDFDRIVER Driver
+)
+/*++
+
+Routine Description:
+
+    Writes the active config to the service's Parameters key, from where
+    KbFilter_LoadPersistedConfig picks it up on the next driver load.
+
+Arguments:
+
+    Driver - Handle to the framework driver object
+
+Return Value:
+
+    NTSTATUS
+
+--*/
+{
+    NTSTATUS    status;
+    WDFKEY      hKey;
+    UCHAR       blob[KB_CONFIG_BLOB_MAX_SIZE];
+    ULONG       length;
+    KB_CONFIG   active;
+    DECLARE_CONST_UNICODE_STRING(valueName, KBFILTR_CONFIG_VALUE_NAME);
+
+    PAGED_CODE();
+
+    active = KbFilter_ReferenceProfile()->Config;
+    KbFilter_DereferenceProfile();
+
+    length = KbCoreSaveConfigBlob(&active, blob, sizeof(blob));
+    if (length == 0) {
+        return STATUS_BUFFER_TOO_SMALL;
+    }
+
+    status = WdfDriverOpenParametersRegistryKey(Driver,
+        KEY_WRITE,
+        WDF_NO_OBJECT_ATTRIBUTES,
+        &hKey);
+    if (!NT_SUCCESS(status)) {
+        DebugPrint(("WdfDriverOpenParametersRegistryKey failed 0x%x\n", status));
+        return status;
+    }
+
+    status = WdfRegistryAssignValue(hKey, &valueName, REG_BINARY, length, blob);
+    WdfRegistryClose(hKey);
+
+    if (!NT_SUCCESS(status)) {
+        DebugPrint(("WdfRegistryAssignValue failed 0x%x\n", status));
     }
 
     return status;
@@ -120,6 +351,8 @@ Return Value:
     WDFQUEUE                hQueue;
     PDEVICE_EXTENSION       filterExt;
     WDF_IO_QUEUE_CONFIG     ioQueueConfig;
+    WDF_OBJECT_ATTRIBUTES   attributes;
+    WDF_TIMER_CONFIG        timerConfig;
 
     UNREFERENCED_PARAMETER(Driver);
 
@@ -140,6 +373,26 @@ Return Value:
 
     filterExt = FilterGetData(hDevice);
 
+    KbCoreInitStream(&filterExt->Stream, QueryRandomSeed() + InstanceNo);
+
+    WDF_OBJECT_ATTRIBUTES_INIT(&attributes);
+    attributes.ParentObject = hDevice;
+
+    status = WdfSpinLockCreate(&attributes, &filterExt->StreamLock);
+    if (!NT_SUCCESS(status)) {
+        DebugPrint(("WdfSpinLockCreate failed 0x%x\n", status));
+        return status;
+    }
+
+    // Releases packets held for transposition when no keystroke follows
+    WDF_TIMER_CONFIG_INIT(&timerConfig, KbFilter_EvtHoldbackTimer);
+
+    status = WdfTimerCreate(&timerConfig, &attributes, &filterExt->HoldbackTimer);
+    if (!NT_SUCCESS(status)) {
+        DebugPrint(("WdfTimerCreate failed 0x%x\n", status));
+        return status;
+    }
+
     // Parallel queue configuration is required for PS/2 ports to avoid deadlocks
     WDF_IO_QUEUE_CONFIG_INIT_DEFAULT_QUEUE(&ioQueueConfig,
         WdfIoQueueDispatchParallel);
@@ -156,15 +409,19 @@ Return Value:
         return status;
     }
 
-    // Secondary queue for RawPDO communication
+    // Secondary queue for RawPDO communication. Its requests touch the
+    // registry (IOCTL_KBFILTR_PERSIST_CONFIG), so they run at PASSIVE_LEVEL.
     WDF_IO_QUEUE_CONFIG_INIT(&ioQueueConfig,
         WdfIoQueueDispatchParallel);
 
     ioQueueConfig.EvtIoDeviceControl = KbFilter_EvtIoDeviceControlFromRawPdo;
 
+    WDF_OBJECT_ATTRIBUTES_INIT(&attributes);
+    attributes.ExecutionLevel = WdfExecutionLevelPassive;
+
     status = WdfIoQueueCreate(hDevice,
         &ioQueueConfig,
-        WDF_NO_OBJECT_ATTRIBUTES,
+        &attributes,
         &hQueue
     );
     if (!NT_SUCCESS(status)) {
@@ -265,19 +522,54 @@ Return Value:
         break;
 
     case IOCTL_SET_PROBABILITY:
-        if (InputBufferLength < sizeof(KB_CONFIG)) { status = STATUS_BUFFER_TOO_SMALL; break; }
-        status = WdfRequestRetrieveInputBuffer(Request, sizeof(KB_CONFIG), &inputBuffer, NULL);
+        // Older clients send only Probability and Mode; the burst fields
+        // then stay zero, which keeps the independent coin flip
+        if (InputBufferLength < KB_CONFIG_LEGACY_SIZE) { status = STATUS_BUFFER_TOO_SMALL; break; }
+        status = WdfRequestRetrieveInputBuffer(Request, KB_CONFIG_LEGACY_SIZE, &inputBuffer, NULL);
         if (NT_SUCCESS(status)) {
-            PKB_CONFIG config = (PKB_CONFIG)inputBuffer;
-            if (config->Probability <= 100) {
-                g_Probability = config->Probability;
-                g_Mode = config->Mode;
-                DebugPrint(("KbFilter: Mode %lu, Prob %lu\n", g_Mode, g_Probability));
+            KB_CONFIG config = { 0 };
+            RtlCopyMemory(&config, inputBuffer,
+                (InputBufferLength < sizeof(KB_CONFIG)) ? InputBufferLength : sizeof(KB_CONFIG));
+            status = KbFilter_PublishProfile(&config);
+            if (NT_SUCCESS(status)) {
+                DebugPrint(("KbFilter: Mode %lu, Prob %lu\n", config.Mode, config.Probability));
             }
-            else status = STATUS_INVALID_PARAMETER;
         }
         break;
 
+    case IOCTL_KBFILTR_PERSIST_CONFIG:
+        status = KbFilter_PersistConfig(WdfGetDriver());
+        break;
+
+    case IOCTL_KBFILTR_GET_HISTOGRAM:
+        if (OutputBufferLength < sizeof(KB_HISTOGRAM)) {
+            status = STATUS_BUFFER_TOO_SMALL;
+            break;
+        }
+
+        status = WdfRequestRetrieveOutputMemory(Request, &outputMemory);
+
+        if (!NT_SUCCESS(status)) {
+            DebugPrint(("WdfRequestRetrieveOutputMemory failed %x\n", status));
+            break;
+        }
+
+        // Counters are read without the stream lock; each is a single
+        // 32-bit word, so the snapshot is at worst a few counts stale
+        status = WdfMemoryCopyFromBuffer(outputMemory,
+            0,
+            &devExt->Stream.Histogram,
+            sizeof(KB_HISTOGRAM));
+
+        if (!NT_SUCCESS(status)) {
+            DebugPrint(("WdfMemoryCopyFromBuffer failed %x\n", status));
+            break;
+        }
+
+        bytesTransferred = sizeof(KB_HISTOGRAM);
+
+        break;
+
     default:
         status = STATUS_NOT_IMPLEMENTED;
         break;
@@ -487,50 +779,290 @@ Return Value:
 {
     PDEVICE_EXTENSION   devExt;
     WDFDEVICE   hDevice;
-    PKEYBOARD_INPUT_DATA currentPacket;
+    BOOLEAN     holding;
+    PKB_PROFILE profile;
+    KBFILTR_STAGING staging;
+    PKEYBOARD_INPUT_DATA chunkStart;
+    PKEYBOARD_INPUT_DATA chunkEnd;
+    ULONG       chunkLength;
+    ULONG       delivered;
+    ULONG       consumed = (ULONG)(InputDataEnd - InputDataStart);
 
     hDevice = WdfWdmDeviceGetWdfDeviceHandle(DeviceObject);
     devExt = FilterGetData(hDevice);
 
-    static const USHORT AllowedScanCodes[] = {
-        0x0E, 0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19,
-        0x1E, 0x1F, 0x20, 0x21, 0x22, 0x23, 0x24, 0x25, 0x26, 0x2C, 0x2D, 0x2E, 0x2F, 0x30, 0x31, 0x32
-    };
-
-    const ULONG ArraySize = sizeof(AllowedScanCodes) / sizeof(AllowedScanCodes[0]);
-
-    // Iterate over packets
-    for (currentPacket = InputDataStart; currentPacket < InputDataEnd; currentPacket++) {
-
-        // Modify only the 'Make' (key down) code to avoid stuck keys
-        if (currentPacket->Flags == KEY_MAKE) {
-
-            g_RandomSeed = Random(&g_RandomSeed);
-
-            // Check probability
-            if ((g_RandomSeed % 100) < g_Probability) {
-                if (g_Mode == 1) {
-				USHORT randomCode = AllowedScanCodes[g_RandomSeed % ArraySize];
-                currentPacket->MakeCode = randomCode;
-                DebugPrint(("KbFilter: Swapped key to ScanCode 0x%x\n", randomCode));
-                }
-                else if (g_Mode == 2) {
-                    // In mode 2, we just drop the key (set to break code)
-                    currentPacket->Flags = KEY_BREAK;
-                    DebugPrint(("KbFilter: Dropped key ScanCode 0x%x\n", currentPacket->MakeCode));
-				}
-				else if (g_Mode == 3){
-                    if (currentPacket->MakeCode == 0x39) currentPacket->MakeCode = KEY_BREAK;
-                }
+    profile = KbFilter_ReferenceProfile();
+
+    // Both paths report to the class driver as the only deliverer, so the
+    // holdback timer cannot release older packets behind this batch
+    WdfSpinLockAcquire(devExt->StreamLock);
+    while (devExt->Delivering) {
+        // The holdback timer is reporting packets that precede this batch
+        WdfSpinLockRelease(devExt->StreamLock);
+        YieldProcessor();
+        WdfSpinLockAcquire(devExt->StreamLock);
+    }
+    devExt->Delivering = TRUE;
+
+    if (!KbCoreIsStreaming(profile, &devExt->Stream) && devExt->Carry.Count == 0) {
+        WdfSpinLockRelease(devExt->StreamLock);
+
+        // Modifies only 'Make' (key down) codes, in place, to avoid stuck keys
+        KbCoreTransform(profile, &devExt->Stream, InputDataStart, InputDataEnd);
+        KbFilter_DereferenceProfile();
+
+        (*(PSERVICE_CALLBACK_ROUTINE)(ULONG_PTR)devExt->UpperConnectData.ClassService)(
+            devExt->UpperConnectData.ClassDeviceObject,
+            InputDataStart,
+            InputDataEnd,
+            InputDataConsumed);
+
+        WdfSpinLockAcquire(devExt->StreamLock);
+        devExt->Delivering = FALSE;
+        WdfSpinLockRelease(devExt->StreamLock);
+        return;
+    }
+
+    // Transposition: packets may be held back for a later callback. The
+    // input is transformed a chunk at a time under the lock, and each
+    // chunk's output is reported to the class driver after releasing it.
+    // Output the class driver refused earlier goes first; while it is still
+    // refused, the port driver keeps the whole batch.
+    if (!KbFilter_DeliverCarry(devExt)) {
+        consumed = 0;
+    }
+    else {
+        for (chunkStart = InputDataStart; chunkStart < InputDataEnd; chunkStart = chunkEnd) {
+            chunkLength = (ULONG)(InputDataEnd - chunkStart);
+            if (chunkLength > KBFILTR_STAGING_PACKETS) {
+                chunkLength = KBFILTR_STAGING_PACKETS;
+            }
+            chunkEnd = chunkStart + chunkLength;
+
+            staging.Count = 0;
+            KbCoreTransformStream(profile, &devExt->Stream, chunkStart, chunkEnd,
+                KbFilter_EmitToStaging, &staging);
+            WdfSpinLockRelease(devExt->StreamLock);
+
+            delivered = KbFilter_DeliverToClass(devExt, staging.Packets, staging.Packets + staging.Count);
+
+            WdfSpinLockAcquire(devExt->StreamLock);
+            if (delivered < staging.Count) {
+                // The class driver is full. The rest of this chunk's output
+                // is carried over, so the chunk counts as consumed; the port
+                // driver keeps the input after it.
+                KbFilter_CarryOver(devExt, &staging, delivered);
+                consumed = (ULONG)(chunkEnd - InputDataStart);
+                break;
             }
         }
     }
 
-    (*(PSERVICE_CALLBACK_ROUTINE)(ULONG_PTR)devExt->UpperConnectData.ClassService)(
-        devExt->UpperConnectData.ClassDeviceObject,
+    devExt->Delivering = FALSE;
+    holding = (devExt->Stream.HeldCount != 0 || devExt->Carry.Count != 0);
+    WdfSpinLockRelease(devExt->StreamLock);
+    KbFilter_DereferenceProfile();
+
+    if (holding) {
+        WdfTimerStart(devExt->HoldbackTimer, WDF_REL_TIMEOUT_IN_MS(KBFILTR_HOLDBACK_TIMEOUT_MS));
+    }
+
+    *InputDataConsumed = consumed;
+}
+
+VOID
+KbFilter_EmitToStaging(
+    IN PVOID Context,
+    IN PKEYBOARD_INPUT_DATA InputDataStart,
+    IN PKEYBOARD_INPUT_DATA InputDataEnd
+)
+/*++
+
+Routine Description:
+
+    Appends one segment of transformed packets to a staging buffer. Runs
+    under StreamLock; the class driver is only called once it is released.
+
+Arguments:
+
+    Context - The KBFILTR_STAGING buffer
+
+--*/
+{
+    PKBFILTR_STAGING staging = (PKBFILTR_STAGING)Context;
+    ULONG count = (ULONG)(InputDataEnd - InputDataStart);
+
+    NT_ASSERT(staging->Count + count <= RTL_NUMBER_OF(staging->Packets));
+
+    RtlCopyMemory(&staging->Packets[staging->Count], InputDataStart, count * sizeof(KEYBOARD_INPUT_DATA));
+    staging->Count += count;
+}
+
+ULONG
+KbFilter_DeliverToClass(
+    IN PDEVICE_EXTENSION DevExt,
+    IN PKEYBOARD_INPUT_DATA InputDataStart,
+    IN PKEYBOARD_INPUT_DATA InputDataEnd
+)
+/*++
+
+Routine Description:
+
+    Reports staged packets to the class driver. Must not be called with
+    StreamLock held.
+
+Arguments:
+
+    DevExt - The device extension
+
+Return Value:
+
+    The number of packets the class driver consumed.
+
+--*/
+{
+    ULONG consumed = 0;
+
+    if (InputDataStart == InputDataEnd) {
+        return 0;
+    }
+
+    (*(PSERVICE_CALLBACK_ROUTINE)(ULONG_PTR)DevExt->UpperConnectData.ClassService)(
+        DevExt->UpperConnectData.ClassDeviceObject,
         InputDataStart,
         InputDataEnd,
-        InputDataConsumed);
+        &consumed);
+
+    return consumed;
+}
+
+VOID
+KbFilter_CarryOver(
+    IN PDEVICE_EXTENSION DevExt,
+    IN PKBFILTR_STAGING Staging,
+    IN ULONG Delivered
+)
+/*++
+
+Routine Description:
+
+    Keeps the staged packets the class driver did not take, to be reported
+    ahead of anything newer. Called by the deliverer, with StreamLock held,
+    only once the carry-over is empty.
+
+Arguments:
+
+    DevExt - The device extension
+
+    Staging - The staged packets
+
+    Delivered - How many of them the class driver took
+
+--*/
+{
+    NT_ASSERT(DevExt->Carry.Count == 0 && Delivered < Staging->Count);
+
+    DevExt->Carry.Count = Staging->Count - Delivered;
+    RtlCopyMemory(DevExt->Carry.Packets, &Staging->Packets[Delivered],
+        DevExt->Carry.Count * sizeof(KEYBOARD_INPUT_DATA));
+}
+
+BOOLEAN
+KbFilter_DeliverCarry(
+    IN PDEVICE_EXTENSION DevExt
+)
+/*++
+
+Routine Description:
+
+    Reports the carry-over to the class driver. Called by the deliverer
+    with StreamLock held; the lock is released around the report.
+
+Arguments:
+
+    DevExt - The device extension
+
+Return Value:
+
+    TRUE if the carry-over is now empty.
+
+--*/
+{
+    ULONG delivered;
+
+    if (DevExt->Carry.Count == 0) {
+        return TRUE;
+    }
+
+    WdfSpinLockRelease(DevExt->StreamLock);
+    delivered = KbFilter_DeliverToClass(DevExt, DevExt->Carry.Packets,
+        DevExt->Carry.Packets + DevExt->Carry.Count);
+    WdfSpinLockAcquire(DevExt->StreamLock);
+
+    if (delivered >= DevExt->Carry.Count) {
+        DevExt->Carry.Count = 0;
+        return TRUE;
+    }
+
+    DevExt->Carry.Count -= delivered;
+    RtlMoveMemory(DevExt->Carry.Packets, &DevExt->Carry.Packets[delivered],
+        DevExt->Carry.Count * sizeof(KEYBOARD_INPUT_DATA));
+    return FALSE;
+}
+
+VOID
+KbFilter_EvtHoldbackTimer(
+    IN WDFTIMER Timer
+)
+/*++
+
+Routine Description:
+
+    No keystroke followed the one held for transposition within
+    KBFILTR_HOLDBACK_TIMEOUT_MS; release it as typed so it is never stuck.
+    Output the class driver refused is retried first, and the timer is
+    restarted for as long as some of it is still refused.
+
+Arguments:
+
+    Timer - Handle to the holdback timer, parented to the device
+
+--*/
+{
+    PDEVICE_EXTENSION devExt = FilterGetData(WdfTimerGetParentObject(Timer));
+    KBFILTR_STAGING staging;
+    ULONG delivered;
+    BOOLEAN retry;
+
+    WdfSpinLockAcquire(devExt->StreamLock);
+    if (devExt->Delivering) {
+        // The service callback is running; it restarts the timer if it
+        // still holds or carries a packet when it is done
+        WdfSpinLockRelease(devExt->StreamLock);
+        return;
+    }
+    devExt->Delivering = TRUE;
+
+    if (KbFilter_DeliverCarry(devExt)) {
+        staging.Count = 0;
+        KbCoreFlushStream(&devExt->Stream, KbFilter_EmitToStaging, &staging);
+        WdfSpinLockRelease(devExt->StreamLock);
+
+        delivered = KbFilter_DeliverToClass(devExt, staging.Packets, staging.Packets + staging.Count);
+
+        WdfSpinLockAcquire(devExt->StreamLock);
+        if (delivered < staging.Count) {
+            KbFilter_CarryOver(devExt, &staging, delivered);
+        }
+    }
+
+    devExt->Delivering = FALSE;
+    retry = (devExt->Carry.Count != 0);
+    WdfSpinLockRelease(devExt->StreamLock);
+
+    if (retry) {
+        WdfTimerStart(devExt->HoldbackTimer, WDF_REL_TIMEOUT_IN_MS(KBFILTR_HOLDBACK_TIMEOUT_MS));
+    }
 }
 
 VOID
@@ -29,10 +29,32 @@ Environment:
 #include <initguid.h>
 #include <devguid.h>
 #include "public.h"
+#include "kbcore.h"
 #pragma warning(default:4201)
 
 #define KBFILTER_POOL_TAG (ULONG) 'tlfK'
 
+// REG_BINARY value under the service's Parameters key holding the config
+// blob applied at DriverEntry (see KB_CONFIG_BLOB_HEADER)
+#define KBFILTR_CONFIG_VALUE_NAME L"PersistedConfig"
+
+// How long KB_MODE_TRANSPOSE waits for the next keystroke before releasing
+// a held one as typed
+#define KBFILTR_HOLDBACK_TIMEOUT_MS 250
+
+// Input packets the streaming service callback transforms per chunk. Each
+// chunk's output is staged under StreamLock and reported to the class
+// driver after the lock is released; a chunk can also release up to
+// KB_HOLDBACK_SLOTS packets held from before it. What the class driver
+// does not take is carried over in the same layout.
+#define KBFILTR_STAGING_PACKETS 16
+
+typedef struct _KBFILTR_STAGING
+{
+    ULONG Count;
+    KEYBOARD_INPUT_DATA Packets[KBFILTR_STAGING_PACKETS + KB_HOLDBACK_SLOTS];
+} KBFILTR_STAGING, * PKBFILTR_STAGING;
+
 #if DBG
 #define DebugPrint(_x_) DbgPrint _x_
 #else
@@ -50,6 +72,23 @@ typedef struct _DEVICE_EXTENSION
     // Cached Keyboard Attributes (for the app)
     KEYBOARD_ATTRIBUTES KeyboardAttributes;
 
+    // Per-device transform engine state (RNG, transposition holdback)
+    KB_STREAM Stream;
+
+    // Serializes the holdback timer with the service callback
+    WDFSPINLOCK StreamLock;
+    WDFTIMER HoldbackTimer;
+
+    // Set, under StreamLock, while the service callback or the timer is
+    // reporting packets, so their output reaches the class driver in
+    // stream order. The callback sets it on both of its paths.
+    BOOLEAN Delivering;
+
+    // Output the class driver did not take, reported ahead of anything
+    // newer by the next callback or timer tick. Changed only under
+    // StreamLock, by whoever set Delivering.
+    KBFILTR_STAGING Carry;
+
 } DEVICE_EXTENSION, * PDEVICE_EXTENSION;
 
 WDF_DECLARE_CONTEXT_TYPE_WITH_NAME(DEVICE_EXTENSION, FilterGetData)
@@ -57,6 +96,7 @@ WDF_DECLARE_CONTEXT_TYPE_WITH_NAME(DEVICE_EXTENSION, FilterGetData)
 // Prototypes
 DRIVER_INITIALIZE DriverEntry;
 EVT_WDF_DRIVER_DEVICE_ADD KbFilter_EvtDeviceAdd;
+EVT_WDF_DRIVER_UNLOAD KbFilter_EvtDriverUnload;
 EVT_WDF_IO_QUEUE_IO_DEVICE_CONTROL KbFilter_EvtIoDeviceControlFromRawPdo;
 EVT_WDF_IO_QUEUE_IO_INTERNAL_DEVICE_CONTROL KbFilter_EvtIoInternalDeviceControl;
 
@@ -68,6 +108,19 @@ VOID KbFilter_ServiceCallback(
 );
 
 EVT_WDF_REQUEST_COMPLETION_ROUTINE KbFilterRequestCompletionRoutine;
+EVT_WDF_TIMER KbFilter_EvtHoldbackTimer;
+KB_EMIT_ROUTINE KbFilter_EmitToStaging;
+ULONG KbFilter_DeliverToClass(
+    IN PDEVICE_EXTENSION DevExt,
+    IN PKEYBOARD_INPUT_DATA InputDataStart,
+    IN PKEYBOARD_INPUT_DATA InputDataEnd
+);
+VOID KbFilter_CarryOver(IN PDEVICE_EXTENSION DevExt, IN PKBFILTR_STAGING Staging, IN ULONG Delivered);
+BOOLEAN KbFilter_DeliverCarry(IN PDEVICE_EXTENSION DevExt);
+
+NTSTATUS KbFilter_PublishProfile(IN const KB_CONFIG* Config);
+VOID KbFilter_LoadPersistedConfig(IN WDFDRIVER Driver);
+NTSTATUS KbFilter_PersistConfig(IN WDFDRIVER Driver);
 
 // Sideband (RawPDO) definitions
 #define  KBFILTR_DEVICE_ID L"{A65C87F9-BE02-4ed9-92EC-012D416169FA}\\KeyboardFilter\0"
@@ -12,9 +12,50 @@
 
 #define IOCTL_SET_PROBABILITY CTL_CODE(FILE_DEVICE_KEYBOARD, IOCTL_INDEX + 1, METHOD_BUFFERED, FILE_ANY_ACCESS)
 
+// Saves the active config to the registry; it is applied at the next boot
+#define IOCTL_KBFILTR_PERSIST_CONFIG CTL_CODE(FILE_DEVICE_KEYBOARD, IOCTL_INDEX + 2, METHOD_BUFFERED, FILE_ANY_ACCESS)
+
+// Returns the device's KB_HISTOGRAM
+#define IOCTL_KBFILTR_GET_HISTOGRAM CTL_CODE(FILE_DEVICE_KEYBOARD, IOCTL_INDEX + 3, METHOD_BUFFERED, FILE_READ_DATA)
+
+// Transform modes accepted in KB_CONFIG::Mode
+#define KB_MODE_NORMAL          0   // pass-through
+#define KB_MODE_CHAOS           1   // swap to a random letter/backspace
+#define KB_MODE_DROP            2   // turn the make code into a break
+#define KB_MODE_DROP_SPACE      3   // mangle the space bar only
+#define KB_MODE_TRANSPOSE       4   // swap a keystroke with the next one
+#define KB_MODE_COUNT           5
+
+//
+// With EnterBad zero, every make code is an independent coin flip with
+// Probability. Otherwise injections follow a Gilbert-Elliott model: a
+// good and a bad state, injecting with Probability and BadProbability,
+// and per make code transition chances EnterBad (good to bad) and ExitBad
+// (bad to good), in units of 1/10000.
+//
 typedef struct _KB_CONFIG {
     ULONG Probability; // 0 to 100
 	ULONG Mode;
+    ULONG BadProbability;   // 0 to 100
+    ULONG EnterBad;         // 0 to 10000
+    ULONG ExitBad;          // 0 to 10000
 } KB_CONFIG, * PKB_CONFIG;
 
+// IOCTL_SET_PROBABILITY also accepts the original two-field KB_CONFIG
+#define KB_CONFIG_LEGACY_SIZE   (sizeof(ULONG) * 2)
+
+// Injection histogram actions
+#define KB_ACTION_SWAPPED_OUT   0   // make code replaced by KB_MODE_CHAOS
+#define KB_ACTION_SWAPPED_IN    1   // code KB_MODE_CHAOS put in its place
+#define KB_ACTION_DROPPED       2   // make dropped (KB_MODE_DROP, KB_MODE_DROP_SPACE)
+#define KB_ACTION_TRANSPOSED    3   // make moved after the next key (KB_MODE_TRANSPOSE)
+#define KB_ACTION_COUNT         4
+
+#define KB_HISTOGRAM_CODES      128 // make codes, E0 keys share their base code
+
+// Per-device injection counts, by action and make code. Counters wrap.
+typedef struct _KB_HISTOGRAM {
+    ULONG Counts[KB_ACTION_COUNT][KB_HISTOGRAM_CODES];
+} KB_HISTOGRAM, * PKB_HISTOGRAM;
+
 #endif
\ No newline at end of file
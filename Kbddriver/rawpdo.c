@@ -42,6 +42,8 @@ Routine Description:
         // Forward these IOCTLs to the parent driver (kbfiltr.c)
     case IOCTL_KBFILTR_GET_KEYBOARD_ATTRIBUTES:
     case IOCTL_SET_PROBABILITY:
+    case IOCTL_KBFILTR_PERSIST_CONFIG:
+    case IOCTL_KBFILTR_GET_HISTOGRAM:
 
         WDF_REQUEST_FORWARD_OPTIONS_INIT(&forwardOptions);
         status = WdfRequestForwardToParentDeviceIoQueue(Request, pdoData->ParentQueue, &forwardOptions);